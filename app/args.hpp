@@ -18,11 +18,15 @@ public:
   bool debug;
   bool cont;
   std::string build_suffix;
+  std::optional<std::string> worker;  // host:port of a DFS coordinator
 
   CmdArgs() : verbose(false) {}
 
   CmdArgs(const cxxopts::ParseResult& result) {
-    input_path = Path(*get_value<std::string>(result, "file", true));
+    worker = get_value<std::string>(result, "worker", false);
+    if (!worker) {
+      input_path = Path(*get_value<std::string>(result, "file", true));
+    }
     config_path = Path(*get_value<std::string>(result, "config", true));
 
     auto output = get_value<std::string>(result, "output", false);
@@ -57,6 +61,7 @@ public:
         "o,output", "Path to the output file", cxxopts::value<std::string>())(
         "b,build-suffix", "Suffix of the build folder", cxxopts::value<std::string>()->default_value(""))(
         "continue", "Do not overwrite the output file and run algorithms only for remaining automata")(
+        "worker", "Solve the DFS subproblems of the coordinator at host:port (with the same config)", cxxopts::value<std::string>())(
         "v,verbose", "Verbose output")(
         "q,quiet", "Quiet output (only warnings and errors)")(
         "d,debug", "Debug output (all messages and timers)")(
@@ -4,6 +4,7 @@
 #include <app/io.hpp>
 #include <external/json.hpp>
 #include <algorithm>
+#include <atomic>
 #include <filesystem>
 #include <optional>
 #include <string>
@@ -22,59 +23,10 @@ public:
       }
       auto algorithms = get_algorithm_names(config);
 
-      auto config_hash = std::to_string(std::hash<std::string>{}(config.dump()));
-      auto build_name = "synchrolib_" + std::to_string(n) + "_" + std::to_string(k) + "_" + config_hash;
-      if (!build_suffix.empty()) {
-        build_name += "_" + build_suffix;
-      }
-      Path libroot = Path("build") / build_name;
-
-      try {
-        Timer jitlib_timer("jit");
-
-        JitLib jitlib;
-        if (std::filesystem::is_directory(libroot)) {
-          Logger::info() << "Loading precompiled library";
-          jitlib.set_dir_path(libroot);
-          jitlib.load("libsynchro.so");
-        } else {
-          Logger::info() << "Recompiling for N = " << n << ", K = " << k;
-          std::filesystem::create_directory(libroot);
-          auto subst_map = get_subst_map(config, n, k);
-          jitlib
-            .substitute(std::vector<std::pair<Path, Path>>{
-                {"synchrolib", "synchrolib"},
-                {"external", "external"},
-                {"jit/makefile", "makefile"},
-                {"jit/makefile_jit", "makefile_jit"},
-                {"jit/makefile_jit_gpu", "makefile_jit_gpu"},
-                {"jit/jitmain.cpp", "jitmain.cpp"},
-                {"jit/jitdefines.hpp", "jitdefines.hpp"}
-              }, libroot, subst_map)
-            .compile(config.value("gpu", false) ? "jit_gpu" : "jit", Logger::get_log_level() >= Logger::LogLevel::VERBOSE)
-            .load("libsynchro.so");
-        }
-        jitlib_timer.stop();
-
-        jitlib.run<const std::string&, const std::vector<std::string>&, AlgoResult&, Logger::LogLevel>("run", aut, algorithms, result, Logger::get_log_level());
-
-      } catch (JitLib::JitLibException& ex) {
-        Logger::error() << "JitLibException: " << ex.what();
-        std::filesystem::remove_all(libroot);
-        std::exit(4);
-      } catch (nlohmann::detail::exception& json_error) {
-        Logger::error() << "Config exception: " << json_error.what();
-        std::filesystem::remove_all(libroot);
-        std::exit(4);
-      } catch (std::exception& err) {
-        Logger::error() << err.what();
-        std::filesystem::remove_all(libroot);
-        std::exit(4);
-      } catch (...) {
-        Logger::error() << "Unknown exception";
-        std::filesystem::remove_all(libroot);
-        std::exit(4);
-      }
+      with_library(config, n, k, build_suffix, [&](JitLib& jitlib) {
+        jitlib.run<const std::string&, const std::vector<std::string>&, AlgoResult&, Logger::LogLevel, std::atomic<bool>&>(
+            "run", aut, algorithms, result, Logger::get_log_level(), interrupted);
+      });
 
       return result.algorithms_run.size() == algorithms.size();
     } catch (nlohmann::detail::exception& json_error) {
@@ -83,6 +35,21 @@ public:
     }
   }
 
+  // whether a run was stopped by SIGINT or SIGTERM (kept here, as the libraries are unloaded)
+  static bool was_interrupted() { return interrupted; }
+
+  // serves a DFS coordinator on the connection fd (closed by the library)
+  static void run_worker(const IO::json& config, uint n, uint k, int fd, const std::string& build_suffix) {
+    try {
+      with_library(config, n, k, build_suffix, [&](JitLib& jitlib) {
+        jitlib.run<int, Logger::LogLevel>("worker", fd, Logger::get_log_level());
+      });
+    } catch (nlohmann::detail::exception& json_error) {
+      Logger::error() << "Config exception: " << json_error.what();
+      std::exit(4);
+    }
+  }
+
 private:
   using Logger = synchrolib::Logger;
   using Timer = synchrolib::Timer;
@@ -94,6 +61,63 @@ private:
 
   using JitLib = jitlib::JitLib<JitLibLogger>;
 
+  template <typename Function>
+  static void with_library(const IO::json& config, uint n, uint k, const std::string& build_suffix, Function fun) {
+    auto config_hash = std::to_string(std::hash<std::string>{}(config.dump()));
+    auto build_name = "synchrolib_" + std::to_string(n) + "_" + std::to_string(k) + "_" + config_hash;
+    if (!build_suffix.empty()) {
+      build_name += "_" + build_suffix;
+    }
+    Path libroot = Path("build") / build_name;
+
+    try {
+      Timer jitlib_timer("jit");
+
+      JitLib jitlib;
+      if (std::filesystem::is_directory(libroot)) {
+        Logger::info() << "Loading precompiled library";
+        jitlib.set_dir_path(libroot);
+        jitlib.load("libsynchro.so");
+      } else {
+        Logger::info() << "Recompiling for N = " << n << ", K = " << k;
+        std::filesystem::create_directory(libroot);
+        auto subst_map = get_subst_map(config, n, k);
+        jitlib
+          .substitute(std::vector<std::pair<Path, Path>>{
+              {"synchrolib", "synchrolib"},
+              {"external", "external"},
+              {"jit/makefile", "makefile"},
+              {"jit/makefile_jit", "makefile_jit"},
+              {"jit/makefile_jit_gpu", "makefile_jit_gpu"},
+              {"jit/jitmain.cpp", "jitmain.cpp"},
+              {"jit/jitdefines.hpp", "jitdefines.hpp"}
+            }, libroot, subst_map)
+          .compile(config.value("gpu", false) ? "jit_gpu" : "jit", Logger::get_log_level() >= Logger::LogLevel::VERBOSE)
+          .load("libsynchro.so");
+      }
+      jitlib_timer.stop();
+
+      fun(jitlib);
+
+    } catch (JitLib::JitLibException& ex) {
+      Logger::error() << "JitLibException: " << ex.what();
+      std::filesystem::remove_all(libroot);
+      std::exit(4);
+    } catch (nlohmann::detail::exception& json_error) {
+      Logger::error() << "Config exception: " << json_error.what();
+      std::filesystem::remove_all(libroot);
+      std::exit(4);
+    } catch (std::exception& err) {
+      Logger::error() << err.what();
+      std::filesystem::remove_all(libroot);
+      std::exit(4);
+    } catch (...) {
+      Logger::error() << "Unknown exception";
+      std::filesystem::remove_all(libroot);
+      std::exit(4);
+    }
+  }
+
   static std::unordered_map<std::string, std::string> get_subst_map(const IO::json& config, uint n, uint k) {
     std::unordered_map<std::string, std::string> subst_map;
     for (auto& algo : config["algorithms"]) {
@@ -119,6 +143,7 @@ private:
 
     defines += synchrolib::make_define("GPU", config.value("gpu", false));
     defines += synchrolib::make_define("GPU_MEMORY", synchrolib::get_str_int(config, "gpu_max_memory_mb", "1024 * 2"));
+    defines += synchrolib::make_define("BITSLICED_LEAVES", config.value("bitsliced_leaves", false));
 
     int64_t threads = config.value("threads", 1);
     if (threads < 1 || threads > 64) {
@@ -150,4 +175,5 @@ private:
   }
 
   static inline const std::string DEFAULT_UPPER_BOUND = "1ULL * AUT_N * AUT_N * AUT_N / 6";
+  static inline std::atomic<bool> interrupted{false};
 };
@@ -2,6 +2,7 @@
 #include <app/args.hpp>
 #include <app/io.hpp>
 #include <app/jit.hpp>
+#include <app/worker.hpp>
 #include <string>
 
 
@@ -18,6 +19,11 @@ int main(int argc, char** argv) {
     Logger::set_log_level(Logger::LogLevel::DEBUG);
   }
 
+  if (args.worker) {
+    Worker::run(*args.worker, IO::read_config(args.config_path), args.build_suffix);
+    return 0;
+  }
+
   auto auts_encoded = IO::read_automata(args.input_path);
   auto config = IO::read_config(args.config_path);
 
@@ -75,6 +81,12 @@ int main(int argc, char** argv) {
                       << result.mlsw_upper_bound << "]";
     }
     IO::push_result(result, index++);
+
+    if (Jit::was_interrupted()) {
+      Logger::warning() << "Interrupted, the remaining " << (auts_encoded.size() - index)
+                        << " automata are skipped (see --continue)";
+      break;
+    }
   }
 
   return 0;
@@ -0,0 +1,70 @@
+#pragma once
+#include <synchrolib/algorithm/exact/dfs_protocol.hpp>
+#include <synchrolib/utils/logger.hpp>
+#include <synchrolib/utils/socket.hpp>
+#include <app/io.hpp>
+#include <app/jit.hpp>
+#include <charconv>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <thread>
+
+// Worker of the distributed DFS (Exact with dfs_coordinator_port). Connects to the
+// coordinator, loads the library for the automaton size it sends (with the local
+// config, which should be the one of the coordinator) and solves the leased
+// subproblems. Then it connects again for the next DFS, until the coordinator is
+// gone for CONNECT_TIMEOUT.
+class Worker {
+public:
+  static void run(const std::string& address, const IO::json& config, const std::string& build_suffix) {
+    auto colon = address.rfind(':');
+    if (colon == std::string::npos) {
+      Logger::error() << "Expected host:port, found " << address;
+      std::exit(1);
+    }
+    auto host = address.substr(0, colon);
+    uint port = 0;
+    auto port_str = address.substr(colon + 1);
+    auto [end, err] = std::from_chars(port_str.data(), port_str.data() + port_str.size(), port);
+    if (err != std::errc() || end != port_str.data() + port_str.size() || port < 1 || port > 65535) {
+      Logger::error() << "Expected a port in [1, 65535], found " << port_str;
+      std::exit(1);
+    }
+
+    while (auto socket = connect(host, port)) {
+      try {
+        if (socket->recv<DfsMessage>() != DfsMessage::JOB) {
+          throw synchrolib::SocketException("unexpected message");
+        }
+        auto n = socket->recv<uint>();
+        auto k = socket->recv<uint>();
+        Logger::info() << "Job for N = " << n << ", K = " << k;
+        Jit::run_worker(config, n, k, socket->release(), build_suffix);
+      } catch (synchrolib::SocketException& ex) {
+        Logger::warning() << ex.what();
+      }
+    }
+  }
+
+private:
+  using Logger = synchrolib::Logger;
+  using DfsMessage = synchrolib::DfsMessage;
+  using Socket = synchrolib::Socket;
+
+  static constexpr auto CONNECT_TIMEOUT = std::chrono::seconds(60);
+  static constexpr auto CONNECT_INTERVAL = std::chrono::milliseconds(500);
+
+  static std::optional<Socket> connect(const std::string& host, uint port) {
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start < CONNECT_TIMEOUT) {
+      try {
+        return Socket::connect(host, port);
+      } catch (synchrolib::SocketException& ex) {
+        std::this_thread::sleep_for(CONNECT_INTERVAL);
+      }
+    }
+    Logger::info() << "No coordinator at " << host << ":" << port;
+    return std::nullopt;
+  }
+};
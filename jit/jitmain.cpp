@@ -1,6 +1,9 @@
 #include <jitdefines.hpp>
 
 #include <synchrolib/synchrolib.hpp>
+#include <synchrolib/utils/interrupt.hpp>
+#include <synchrolib/utils/socket.hpp>
+#include <atomic>
 #include <iostream>
 #include <memory>
 
@@ -8,12 +11,14 @@ extern "C" {
 
 using namespace synchrolib;
 
+// interrupted is set by SIGINT or SIGTERM during the run, see InterruptScope
 void run(const std::string& aut_encoded,
     const std::vector<std::string>& algorithms, AlgoResult& result,
-    Logger::LogLevel log_level) {
+    Logger::LogLevel log_level, std::atomic<bool>& interrupted) {
   Timer timer("algorithms");
 
   Logger::set_log_level(log_level);
+  InterruptScope::set_flag(interrupted);
 
   AlgoData<AUT_N, AUT_K> data = AlgoData<AUT_N, AUT_K>(
       Automaton<AUT_N, AUT_K>::decode(aut_encoded));
@@ -47,4 +52,16 @@ void run(const std::string& aut_encoded,
 
   result = data.result;
 }
+
+// serves the DFS coordinator on the connection fd (see dfs_protocol.hpp)
+void worker(int fd, Logger::LogLevel log_level) {
+  Logger::set_log_level(log_level);
+
+  Socket socket(fd);
+#ifdef COMPILE_EXACT
+  Dfs<AUT_N, AUT_K>::run_worker(socket);
+#else
+  Logger::error() << "Exact is not in the config";
+#endif
+}
 }
@@ -0,0 +1,118 @@
+// Microbenchmark of SubsetKernels::find_first against the scalar loop (ns per tested
+// set), for N = 64, 128, 256 and arrays of 6 (a leaf), 32 and 256 sets (a bucket).
+// "random": random sets, a test mostly fails at the first word; "hard": the sets differ
+// from the query by one element in a random word (subset relation only).
+//
+// Build and run from the repository root (add -mno-avx512f to the bench target for the
+// AVX2 kernels, -mno-avx2 -mno-avx512f for the scalar fallback only):
+//   make bench
+//   ./build/subset_kernels_bench
+#include <synchrolib/data_structures/subset_kernels.hpp>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace synchrolib;
+
+namespace {
+
+constexpr size_t TESTS = 1 << 22;  // tested sets per measurement
+constexpr size_t QUERIES = 256;
+
+template <uint N>
+Subset<N> random_set(std::mt19937_64& rng, double density) {
+  std::bernoulli_distribution bit(density);
+  auto set = Subset<N>::Empty();
+  for (uint i = 0; i < N; ++i) {
+    if (bit(rng)) set.set(i);
+  }
+  return set;
+}
+
+template <uint N, SetRelation R, bool Proper>
+size_t scalar_find_first(const Subset<N>& x, const Subset<N>* sets, size_t cnt) {
+  for (size_t i = 0; i < cnt; ++i) {
+    if (SubsetKernels<N>::template in_relation<R, Proper>(x, sets[i])) return i;
+  }
+  return cnt;
+}
+
+template <class Fun>
+double ns_per_set(size_t bucket, Fun fun) {
+  size_t acc = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t k = 0; k < TESTS / bucket; ++k) {
+    acc += fun(k % QUERIES);
+  }
+  double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  static volatile size_t sink;
+  sink = acc;
+  return s * 1e9 / TESTS;
+}
+
+template <uint N, SetRelation R, bool Proper>
+void run(const char* name, bool hard, size_t bucket) {
+  std::mt19937_64 rng(1);
+  double set_density = (R == SetRelation::SUBSET_OF ? 0.25 : 0.5);
+  double query_density = (R == SetRelation::SUBSET_OF ? 0.75 : 0.25);
+  std::vector<Subset<N>> sets(bucket);
+  std::vector<Subset<N>> queries(QUERIES);
+  for (auto& query : queries) query = random_set<N>(rng, query_density);
+  for (auto& set : sets) set = random_set<N>(rng, set_density);
+  if (hard) {
+    for (auto& query : queries) query = queries[0];
+    for (auto& set : sets) {
+      for (uint b = 0; b < Subset<N>::buckets(); ++b) set.v[b] = queries[0].v[b] & rng();
+      for (uint i = rng() % N; ; i = rng() % N) {
+        if (!queries[0].is_set(i)) {
+          set.set(i);
+          break;
+        }
+      }
+    }
+  }
+
+  for (auto& query : queries) {
+    if (SubsetKernels<N>::template find_first<R, Proper>(query, sets.data(), bucket) !=
+        scalar_find_first<N, R, Proper>(query, sets.data(), bucket)) {
+      std::printf("%s N=%u: the kernel differs from the scalar loop\n", name, N);
+      std::exit(1);
+    }
+  }
+
+  double scalar = ns_per_set(bucket, [&](size_t q) {
+    return scalar_find_first<N, R, Proper>(queries[q], sets.data(), bucket);
+  });
+  double kernel = ns_per_set(bucket, [&](size_t q) {
+    return SubsetKernels<N>::template find_first<R, Proper>(queries[q], sets.data(), bucket);
+  });
+  std::printf("%-7s %-15s N=%3u sets=%3zu  scalar %.2f ns  kernel %.2f ns\n",
+      hard ? "hard" : "random", name, N, bucket, scalar, kernel);
+}
+
+template <uint N>
+void run_all() {
+  for (size_t bucket : {6, 32, 256}) {
+    run<N, SetRelation::SUBSET_OF, false>("subset", false, bucket);
+    run<N, SetRelation::SUBSET_OF, true>("proper subset", false, bucket);
+    run<N, SetRelation::SUPERSET_OF, false>("superset", false, bucket);
+    run<N, SetRelation::DISJOINT_WITH, false>("disjoint", false, bucket);
+    run<N, SetRelation::SUBSET_OF, false>("subset", true, bucket);
+  }
+}
+
+}  // namespace
+
+int main() {
+#if defined(__AVX512F__)
+  std::printf("kernels: AVX-512\n");
+#elif defined(__AVX2__)
+  std::printf("kernels: AVX2\n");
+#else
+  std::printf("kernels: scalar\n");
+#endif
+  run_all<64>();
+  run_all<128>();
+  run_all<256>();
+}
@@ -11,6 +11,7 @@
 #include <synchrolib/utils/general.hpp>
 #include <synchrolib/utils/logger.hpp>
 #include <synchrolib/utils/distribution.hpp>
+#include <synchrolib/utils/thread_pool.hpp>
 #include <cassert>
 #include <cmath>
 #include <cstring>
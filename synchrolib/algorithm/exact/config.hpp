@@ -2,6 +2,7 @@
 #include <synchrolib/algorithm/config.hpp>
 #include <external/json.hpp>
 #include <iostream>
+#include <stdexcept>
 #include <string>
 #include <utility>
 #include <vector>
@@ -39,9 +40,42 @@ private:
     auto dfs_min_list_size = get_str_int(config, "dfs_min_list_size", "10000");
     ret += make_define("DFS_MIN_LIST_SIZE", dfs_min_list_size);
 
+    auto dfs_processes = get_str_int(config, "dfs_processes", "1");
+    ret += make_define("DFS_PROCESSES", dfs_processes);
+
+    auto dfs_coordinator_port = get_str_int(config, "dfs_coordinator_port", "0");
+    ret += make_define("DFS_COORDINATOR_PORT", dfs_coordinator_port);
+
+    auto dfs_cache_mb = get_str_int(config, "dfs_cache_mb", "64");
+    ret += make_define("DFS_CACHE_MB", dfs_cache_mb);
+
+    auto dfs_trie_dir = config.value("dfs_trie_dir", "");
+    ret += make_define("DFS_TRIE_DIR", json(dfs_trie_dir).dump());
+
+    auto dfs_order = config.value("dfs_order", "cardinality");
+    if (dfs_order == "cardinality") {
+      ret += make_define("DFS_ORDER_CARDINALITY");
+    } else if (dfs_order == "density") {
+      ret += make_define("DFS_ORDER_DENSITY");
+    } else {
+      throw std::runtime_error("dfs_order value not in [cardinality, density]");
+    }
+
+    auto dfs_discrepancies = get_str_int(config, "dfs_discrepancies", "0");
+    ret += make_define("DFS_DISCREPANCIES", dfs_discrepancies);
+
     auto bfs_small_list_size = get_str_int(config, "bfs_small_list_size", "AUT_N * 16");
     ret += make_define("BFS_SMALL_LIST_SIZE", bfs_small_list_size);
 
+    auto cost_calibration = get_str_bool(config, "cost_calibration", "true");
+    ret += make_define("COST_CALIBRATION", cost_calibration);
+
+    auto max_time_s = get_str_int(config, "max_time_s", "0");
+    ret += make_define("MAX_TIME_S", max_time_s);
+
+    auto find_word = get_str_bool(config, "find_word", "false");
+    ret += make_define("FIND_WORD", find_word);
+
     return ret;
   }
 
@@ -49,7 +83,12 @@ private:
     return
         make_undefine("DFS_SHORTCUT") + make_undefine("MAX_MEMORY") +
         make_undefine("DFS_MIN_LIST_SIZE") + make_undefine("BFS_SMALL_LIST_SIZE") +
-        make_undefine("DFS") + make_undefine("STRICT_MEMORY_LIMIT");
+        make_undefine("DFS") + make_undefine("STRICT_MEMORY_LIMIT") +
+        make_undefine("COST_CALIBRATION") + make_undefine("FIND_WORD") +
+        make_undefine("DFS_PROCESSES") + make_undefine("DFS_COORDINATOR_PORT") +
+        make_undefine("DFS_CACHE_MB") + make_undefine("DFS_ORDER_CARDINALITY") +
+        make_undefine("DFS_ORDER_DENSITY") + make_undefine("DFS_DISCREPANCIES") +
+        make_undefine("MAX_TIME_S") + make_undefine("DFS_TRIE_DIR");
   }
 };
 
@@ -0,0 +1,208 @@
+#include <jitdefines.hpp>
+#ifdef COMPILE_EXACT
+
+#include "cost_model.hpp"
+
+#include <synchrolib/data_structures/preprocessed_transition.hpp>
+#include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/data_structures/subset_utils.hpp>
+#include <synchrolib/data_structures/subsets_implicit_trie.hpp>
+#include <synchrolib/utils/logger.hpp>
+#include <synchrolib/utils/timer.hpp>
+#include <synchrolib/utils/vector.hpp>
+#include <dlfcn.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <random>
+
+#ifndef __INTELLISENSE__
+$EXACT_DEF$
+#endif
+
+namespace synchrolib {
+
+template<uint N, uint K>
+const CostModel<N, K>& CostModel<N, K>::get(const std::array<PreprocessedTransition<N, K>, K>& ptrans) {
+  static CostModel model = [&ptrans] {
+    CostModel model;
+#if COST_CALIBRATION
+    auto path = get_cache_path();
+    if (!model.load(path)) {
+      model.calibrate(ptrans);
+      model.save(path);
+    }
+#endif
+    return model;
+  }();
+  return model;
+}
+
+// in the directory of this library, empty if it is unknown
+template<uint N, uint K>
+std::string CostModel<N, K>::get_cache_path() {
+  Dl_info info;
+  if (!dladdr(reinterpret_cast<void*>(&CostModel::get_cache_path), &info) || !info.dli_fname) {
+    return "";
+  }
+  return (std::filesystem::path(info.dli_fname).parent_path() / "cost_model.txt").string();
+}
+
+template<uint N, uint K>
+bool CostModel<N, K>::load(const std::string& path) {
+  std::ifstream is(path);
+  cost_t cached_set_cost;
+  double cached_node_ns;
+  if (path.empty() || !(is >> cached_set_cost >> cached_node_ns) || cached_set_cost <= 0) {
+    return false;
+  }
+  set_cost = cached_set_cost;
+  node_ns = cached_node_ns;
+  Logger::debug() << "Cost model loaded |"
+    << " node: " << node_ns << "ns"
+    << " set_cost: " << set_cost;
+  return true;
+}
+
+// written to a temporary file first, so a concurrent run never reads a partial one
+template<uint N, uint K>
+void CostModel<N, K>::save(const std::string& path) const {
+  if (path.empty()) {
+    return;
+  }
+  auto tmp_path = path + "." + std::to_string(getpid());
+  {
+    std::ofstream os(tmp_path);
+    os.precision(std::numeric_limits<cost_t>::max_digits10);
+    os << set_cost << " " << node_ns << std::endl;
+    if (!os) {
+      Logger::debug() << "Cost model not saved to " << path;
+      std::remove(tmp_path.c_str());
+      return;
+    }
+  }
+  std::rename(tmp_path.c_str(), path.c_str());
+}
+
+template<uint N, uint K>
+void CostModel<N, K>::calibrate(const std::array<PreprocessedTransition<N, K>, K>& ptrans) {
+  Timer timer("cost calibration");
+  constexpr size_t SETS = 1 << 13;
+  constexpr size_t QUERIES = 1 << 12;
+  constexpr uint REPEATS = 3;
+  constexpr double SET_DENSITY = 0.5;
+  constexpr double MIN_INDEX_DENSITY = 0.25;     // list_bfs sets are usually small
+  constexpr double MAX_INDEX_DENSITY = 0.75;
+  constexpr double MAX_HITS = 1.0 / 64;          // expected index sets in a query
+  constexpr double MAX_HIT_FRACTION = 1.0 / 16;  // of the queries with a subset, in an accepted fit
+  constexpr cost_t MAX_DEVIATION = 16;           // fits beyond this factor of the defaults are rejected
+
+  // The check of a query stops at its first subset, while get_trie_evn counts the
+  // whole traversal, so the densities make a subset in a query unlikely: an index set
+  // is in a query with probability (1 - p (1 - q))^N. Small automata (N below ~20)
+  // leave no such densities and keep the defaults.
+  double index_density = 0, query_density = 0;
+  for (double q : {0.5, 0.25}) {
+    for (double p = MIN_INDEX_DENSITY; p <= MAX_INDEX_DENSITY && !index_density; p += 0.125) {
+      if (SETS * std::pow(1 - p * (1 - q), N) <= MAX_HITS) {
+        index_density = p;
+        query_density = q;
+      }
+    }
+  }
+  if (!index_density) {
+    Logger::debug() << "Cost calibration skipped for N = " << N << ", using the default cost model";
+    return;
+  }
+
+  std::mt19937_64 rng(N * K);
+  auto random_list = [&rng](size_t cnt, double density) {
+    std::bernoulli_distribution bit(density);
+    FastVector<Subset<N>> list(cnt);
+    for (auto& sub : list) {
+      sub = Subset<N>::Empty();
+      for (uint n = 0; n < N; ++n) {
+        if (bit(rng)) sub.set(n);
+      }
+    }
+    return list;
+  };
+  auto elapsed_ns = [](Timer& t) {
+    return static_cast<double>(t.template stop<false, std::chrono::nanoseconds>());
+  };
+
+  // BFS step: apply all letters and sort the result
+  double apply_ns = std::numeric_limits<double>::infinity();
+  double sort_ns = std::numeric_limits<double>::infinity();
+  {
+    auto list = random_list(SETS, SET_DENSITY);
+    FastVector<Subset<N>> buffer(K * SETS);
+    for (uint r = 0; r < REPEATS; ++r) {
+      Timer apply("apply");
+      for (uint k = 0; k < K; ++k) {
+        ptrans[k].apply(list.data(), buffer.data() + k * SETS, SETS);
+      }
+      apply_ns = std::min(apply_ns, elapsed_ns(apply) / (K * SETS));
+
+      Timer sort("sort");
+      sort_keep_unique(buffer);
+      sort_ns = std::min(sort_ns, elapsed_ns(sort) / (K * SETS));
+      buffer.resize(K * SETS);
+    }
+  }
+
+  // goal check (implicit trie)
+  double implicit_ns = std::numeric_limits<double>::infinity();
+  size_t index_size;
+  size_t hits = 0;
+  {
+    auto index = random_list(SETS, index_density);
+    sort_keep_unique(index);
+    index_size = index.size();
+    auto queries = random_list(QUERIES, query_density);
+    sort_keep_unique(queries);
+
+    for (uint r = 0; r < REPEATS; ++r) {
+      auto check = queries;
+      Timer check_timer("check");
+      auto it = SubsetsImplicitTrie<N, false, THREADS, true>::check_contains_subset(index, check);
+      implicit_ns = std::min(implicit_ns, elapsed_ns(check_timer) / check.size());
+      hits = std::distance(it, check.end());
+    }
+  }
+
+  double fitted_node_ns = implicit_ns / get_trie_evn<N>(index_size, query_density, index_density);
+  cost_t fitted_set_cost = (apply_ns + sort_ns) / fitted_node_ns;
+
+  Logger::debug() << "Cost calibration |"
+    << " apply: " << apply_ns << "ns"
+    << " sort: " << sort_ns << "ns"
+    << " index density: " << index_density
+    << " query density: " << query_density
+    << " hits: " << hits
+    << " node: " << fitted_node_ns << "ns"
+    << " set_cost: " << fitted_set_cost;
+
+  if (!std::isfinite(fitted_set_cost) || fitted_node_ns <= 0 || hits > QUERIES * MAX_HIT_FRACTION ||
+      fitted_set_cost < set_cost / MAX_DEVIATION || fitted_set_cost > set_cost * MAX_DEVIATION) {
+    Logger::warning() << "Cost calibration rejected, using the default cost model";
+    return;
+  }
+  set_cost = fitted_set_cost;
+  node_ns = fitted_node_ns;
+}
+
+template class CostModel<AUT_N, AUT_K>;
+
+}  // namespace synchrolib
+
+#ifndef __INTELLISENSE__
+$EXACT_UNDEF$
+#endif
+
+#endif
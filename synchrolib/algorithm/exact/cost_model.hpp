@@ -0,0 +1,49 @@
+#pragma once
+#include <jitdefines.hpp>
+
+#include <synchrolib/data_structures/preprocessed_transition.hpp>
+#include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/utils/general.hpp>
+#include <array>
+#include <string>
+
+#ifndef __INTELLISENSE__
+$EXACT_DEF$
+#endif
+
+namespace synchrolib {
+
+// Constants of the cost model used by MeetInTheMiddle::calculate_decision().
+// All costs are expressed in implicit trie node visits (see get_trie_evn() in subset_utils.hpp).
+// The defaults were tuned by hand; with COST_CALIBRATION set_cost is fitted to the
+// machine by timing apply, sort and trie checks on random sets. The DFS weights
+// are kept, they account for early exits and reductions in DFS which a
+// microbenchmark does not reproduce. The fitted constants are saved next to the
+// library (built for the machine, N, K and the config), which is reloaded for
+// each automaton, so the benchmark runs once per build. Small N (no density gives
+// few enough trie hits) and implausible fits keep the defaults.
+template <uint N, uint K>
+class CostModel {
+public:
+  using cost_t = long double;
+
+  cost_t set_cost = 512;                // applying a letter to a set in a BFS step (with sorting)
+  cost_t dfs_set_cost_weight = 0.25;    // applying a letter to a set in DFS, relative to set_cost
+  cost_t dfs_check_cost_weight = 0.25;  // SubsetsTrie check in DFS, relative to the implicit trie
+  double node_ns = 0;                   // time of a node visit in nanoseconds (0 if not calibrated)
+
+  // calibrated once per build of the library, ptrans are only used for the apply benchmark
+  static const CostModel& get(const std::array<PreprocessedTransition<N, K>, K>& ptrans);
+
+private:
+  void calibrate(const std::array<PreprocessedTransition<N, K>, K>& ptrans);
+  bool load(const std::string& path);
+  void save(const std::string& path) const;
+  static std::string get_cache_path();
+};
+
+}  // namespace synchrolib
+
+#ifndef __INTELLISENSE__
+$EXACT_UNDEF$
+#endif
@@ -7,10 +7,13 @@
 #include <synchrolib/algorithm/algorithm.hpp>
 #include <synchrolib/algorithm/exact/utils.hpp>
 #include <synchrolib/algorithm/exact/meet_in_the_middle.hpp>
+#include <synchrolib/algorithm/exact/dfs_protocol.hpp>
 #include <synchrolib/data_structures/automaton.hpp>
+#include <synchrolib/data_structures/pairs_bound.hpp>
 #include <synchrolib/data_structures/preprocessed_transition.hpp>
 #include <synchrolib/data_structures/subset.hpp>
 #include <synchrolib/data_structures/subset_utils.hpp>
+#include <synchrolib/data_structures/subsets_cache.hpp>
 #include <synchrolib/utils/thread_pool.hpp>
 #include <synchrolib/utils/vector.hpp>
 #include <synchrolib/data_structures/subsets_trie.hpp>
@@ -18,18 +21,36 @@
 #include <synchrolib/utils/connectivity.hpp>
 #include <synchrolib/utils/distribution.hpp>
 #include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/interrupt.hpp>
 #include <synchrolib/utils/logger.hpp>
+#include <synchrolib/utils/mapped_file.hpp>
 #include <synchrolib/utils/timer.hpp>
+#include <synchrolib/utils/shared_memory.hpp>
+#include <synchrolib/utils/socket.hpp>
+#include <synchrolib/utils/work_stealing_pool.hpp>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include <thread>
 #include <cassert>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
+#include <csignal>
+#include <cstdlib>
 #include <cstring>
 #include <exception>
+#include <iostream>
+#include <limits>
 #include <map>
 #include <numeric>
 #include <future>
 #include <optional>
+#include <sstream>
+#include <string>
 #include <utility>
+#include <vector>
 
 #ifndef __INTELLISENSE__
 $EXACT_DEF$
@@ -45,19 +66,30 @@ Dfs<N, K>::Dfs(
     std::array<PreprocessedTransition<N, K>, K>& invptrans,
     uint64& reset_threshold,
     FastVector<Subset<N>>& list_bfs,
+    const SubsetsStats<N>& stats_bfs,
+    uint64 bfs_depth,
     FastVector<Subset<N>>& list_invbfs,
+    const SubsetsStats<N>& stats_invbfs,
     uint64 max_depth,
-    size_t max_memory):
+    size_t max_memory,
+    bool forward):
   aut(aut),
   invaut(invaut),
   ptrans(ptrans),
   invptrans(invptrans),
   reset_threshold(reset_threshold),
   list_bfs(list_bfs),
+  stats_bfs(stats_bfs),
+  bfs_depth(bfs_depth),
   list_bfs_size(list_bfs.size()),
   list_invbfs(list_invbfs),
+  stats_invbfs(stats_invbfs),
   max_depth(max_depth),
-  max_memory(max_memory) {
+  max_memory(max_memory),
+  forward(forward),
+  workers(THREADS > 1 && !forward && DFS_PROCESSES == 1 ? THREADS : 1),
+  processes(forward ? 1 : DFS_PROCESSES),
+  meeting_depth(bfs_depth) {
 }
 
 template<uint N, uint K>
@@ -73,17 +105,44 @@ bool Dfs<N, K>::run() {
     prepare();
 
     Logger::verbose() << "(DFS) range: [" << reset_threshold << ", " << max_depth << "]"
-                      << " trie_bfs sets count: " << trie_bfs.get_sets_count()
-                      << " initial list size: " << list_invbfs.size()
+                      << (forward ? " forward" : " inverse")
+                      << " indexed sets count: " << (forward ? trie_invbfs : trie_bfs).get_sets_count()
+                      << " initial list size: " << get_dfs_list().size()
                       << " max list size: " << dfs_max_list_size;
 
     Timer timer_dfs("dfs");
-    process_invdfs(0, list_invbfs.size(), reset_threshold, 0);
+    dfs_start = Clock::now();
+    if (!forward && DFS_DISCREPANCIES) {
+      probe_invdfs(0, list_invbfs.size(), reset_threshold, 0, DFS_DISCREPANCIES);
+      Logger::verbose() << "(DFS) probe with " << DFS_DISCREPANCIES << " discrepancies | max depth: "
+                        << max_depth << " time: " << get_dfs_ms() << "ms";
+    }
+    if (reset_threshold == max_depth) {
+      // the probe found a word of the lower bound
+    } else if (forward) {
+      process_dfs(0, list_bfs.size(), reset_threshold, 0);
+    } else if (DFS_COORDINATOR_PORT) {
+      process_invdfs_coordinator();
+    } else if (processes > 1) {
+      process_invdfs_processes();
+    } else if (workers > 1) {
+      process_invdfs_parallel();
+    } else {
+      allocate_refuted();
+      process_invdfs(0, list_invbfs.size(), reset_threshold, 0);
+    }
     timer_dfs.stop();
+    if (found_count) {
+      Logger::verbose() << "(DFS) bound lowered " << found_count << " times, first after "
+                        << first_found_ms << "ms, last after " << last_found_ms << "ms";
+    }
 
   } catch (OutOfMemoryException& ex) {
     Logger::error() << "(DFS) out of memory, please consider changing dfs_min_list_size to something smaller";
     return false;
+  } catch (InterruptedException& ex) {
+    Logger::warning() << "(DFS) interrupted after " << get_dfs_ms() << "ms, max depth: " << max_depth;
+    return false;
   }
 
   reset_threshold = max_depth;
@@ -95,25 +154,21 @@ size_t Dfs<N, K>::get_memory_usage() const {
   return synchrolib::get_memory_usage(list_bfs) +
       synchrolib::get_memory_usage(list_invbfs) +
       synchrolib::get_memory_usage(trie_bfs) +
+      synchrolib::get_memory_usage(trie_invbfs) +
+      synchrolib::get_memory_usage(refuted) +
+      synchrolib::get_memory_usage(bfs_segments) +
       synchrolib::get_memory_usage(ptrans) +
-      synchrolib::get_memory_usage(invptrans);
+      synchrolib::get_memory_usage(invptrans) +
+      task_bytes + worker_list_bytes;
 }
 
+// the states frequent in the indexed sets come first
 template<uint N, uint K>
-FastVector<uint> Dfs<N, K>::get_order() {
-  FastVector<double> weights(N);
-  for (const auto& sub : list_bfs) {
-    for (uint i = 0; i < N; ++i) {
-      if (sub.is_set(i)) {
-        weights[i]++;
-      }
-    }
-  }
-
+FastVector<uint> Dfs<N, K>::get_order(const SubsetsStats<N>& stats) {
   FastVector<std::pair<double, uint>> indices(N);
   for (uint i = 0; i < N; ++i) {
     indices[i] = {
-      1.0 - weights[i] / (list_bfs.size() * N),
+      1.0 - static_cast<double>(stats.frequency[i]) / (stats.count * N),
       i
     };
   }
@@ -130,11 +185,11 @@ FastVector<uint> Dfs<N, K>::get_order() {
 template<uint N, uint K>
 void Dfs<N, K>::prepare() {
   Logger::verbose() << "Permuting the automaton";
-  auto order = get_order();
+  auto order = (forward ?
+      get_order(stats_invbfs.negated()) :
+      get_order(stats_bfs));
 
-  uint64 card_list = 0;
-  for (auto &s: list_bfs) card_list += s.size();
-  density_bfs = static_cast<cost_t>(card_list) / (N * list_bfs.size());
+  density_bfs = stats_bfs.density();
   Logger::debug() << "density_bfs " << density_bfs;
     
   for (auto& item : list_bfs) {
@@ -152,51 +207,61 @@ void Dfs<N, K>::prepare() {
   }
 
   Logger::verbose() << "Building trie";
-  trie_bfs.template build<true>(std::move(list_bfs)); // TODO: memory check? (should not be needed because of M param)
-  list_bfs = FastVector<Subset<N>>();
+  if (forward) {
+    for (auto& item : list_invbfs) {
+      item.negate();
+    }
+    trie_invbfs.template build<true>(std::move(list_invbfs));
+    list_invbfs = FastVector<Subset<N>>();
+  } else {
+    build_trie_bfs(std::move(list_bfs)); // TODO: memory check? (should not be needed because of M param)
+    list_bfs = FastVector<Subset<N>>();
+  }
+  pairs_bound.initialize(aut);
+  remove_distant_bfs();
+  if (!forward) {
+    update_state_weights();
+  }
+  plan_refuted();
 
   update_dfs_max_list_size();
 }
 
 template<uint N, uint K>
 void Dfs<N, K>::process_invdfs(size_t begin, size_t end, const uint64 lsw, const uint64 depth) {
+  InterruptScope::check();
   size_t initial_size = list_invbfs.size(); // TODO: add list_invbfs.resize(initial_size) as ScopeExit
   size_t size = end - begin;
 
-#if GPU
-  static constexpr size_t MAX_REDUCE = 100'000;
-#else
-  static constexpr size_t MAX_REDUCE = 10'000;
-#endif
-  size_t reduce_subsets = MAX_REDUCE / std::pow(static_cast<cost_t>(K), depth);
-
-  // TODO: better reduction equations
-  auto[found, next_begin, next_end] = invbfs_step_dfs(begin, end,
-      (depth <= 3 || depth % 2 == 0) && lsw + 1 < max_depth, // reduce_duplicates
-      (depth % 3 == 0 && depth <= 6 && lsw + 10 < max_depth ? 20000 : 0) // old (for benchmark)
-      // (lsw + 4 < max_depth && reduce_subsets >= 10 ? reduce_subsets : 0) // new
-  );
+  auto[found, next_begin, next_end] = invbfs_step_dfs<THREADS>(list_invbfs, begin, end, lsw, depth);
   if (found) {
+#if FIND_WORD
+    save_meeting_set(list_invbfs, next_begin, next_end);
+#endif
     max_depth = lsw;
+    publish_found(lsw);
     if (max_depth > reset_threshold) {
+      remove_distant_bfs();
       update_dfs_max_list_size();
     }
     Logger::verbose() << "(DFS) found length: " << (lsw + 1)
                       << " new max depth: " << max_depth
-                      << " new max list size " << dfs_max_list_size;
+                      << " new max list size " << dfs_max_list_size
+                      << " after " << note_found() << "ms";
     list_invbfs.resize(initial_size);
     return;
   }
 
   if (lsw + 1 >= max_depth) {
+    remember_refuted(next_begin, next_end, lsw + 1);
     list_invbfs.resize(initial_size);
     return;
   }
+  order_branches(list_invbfs, next_begin, next_end);
 
   size_t next_size = next_end - next_begin;
 
-  size_t partsize =
-      (dfs_max_list_size >= size / 2 ? dfs_max_list_size : size / 2);
+  size_t partsize = std::max<size_t>(dfs_max_list_size, size / 2);
   Logger::verbose() << "(DFS) length: " << (lsw + 1)
                     << " list size: " << next_size << " branches: "
                     << ((next_size - 1) / partsize + 1)
@@ -204,74 +269,1193 @@ void Dfs<N, K>::process_invdfs(size_t begin, size_t end, const uint64 lsw, const
 
   size_t pos = 0;
   while (pos + partsize < next_size) {
+    uint64 bound = max_depth;
     process_invdfs(next_begin + pos,
         next_begin + (pos + partsize), lsw + 1, depth + 1);
+    sync_max_depth();
     if (lsw + 1 >= max_depth) {
       list_invbfs.resize(initial_size);
       return;
     }
+    if (max_depth == bound) {
+      remember_refuted(next_begin + pos, next_begin + (pos + partsize), lsw + 1);
+    }
     pos += partsize;
-    partsize = (dfs_max_list_size >= size / 2 ? dfs_max_list_size : size / 2);
+    partsize = std::max<size_t>(dfs_max_list_size, size / 2);
   }
+  uint64 bound = max_depth;
   process_invdfs(next_begin + pos, next_end, lsw + 1, depth + 1);
+  if (max_depth == bound) {
+    remember_refuted(next_begin + pos, next_end, lsw + 1);
+  }
+  list_invbfs.resize(initial_size);
+}
+
+// The cache of refuted sets is sized from the frontier, at most DFS_CACHE_MB and a
+// 1 / REFUTED_MEMORY_FRACTION of the memory left. Each process (a forked one or a
+// TCP worker) has its own copy, allocated only when it starts searching, so the
+// probe alone or the coordinator never pays for it. The threads of the parallel
+// inverse DFS and the forward DFS do not use it.
+template<uint N, uint K>
+void Dfs<N, K>::plan_refuted() {
+  refuted_bytes = 0;
+  if (forward || workers > 1 || (DFS_COORDINATOR_PORT && !coordinator)) {
+    return;
+  }
+  auto memory_usage = get_memory_usage();
+  size_t memory_left = (max_memory > memory_usage ? max_memory - memory_usage : 0);
+  refuted_bytes = std::min({
+      static_cast<size_t>(DFS_CACHE_MB) * 1024 * 1024,
+      list_invbfs.size() * REFUTED_SETS_PER_FRONTIER_SET * SubsetsCache<N>::get_entry_size(),
+      memory_left / (REFUTED_MEMORY_FRACTION * processes)});
+}
+
+template<uint N, uint K>
+void Dfs<N, K>::allocate_refuted() {
+  if (refuted_bytes && refuted.empty()) {
+    refuted.initialize(refuted_bytes);
+  }
+}
+
+// The sets [begin, end) of list_invbfs at lsw were searched up to max_depth
+// without a word (the branch ended without lowering max_depth), so they can be
+// skipped when they appear again with at most as many remaining steps.
+template<uint N, uint K>
+void Dfs<N, K>::remember_refuted(size_t begin, size_t end, uint64 lsw) {
+  if (refuted.empty()) {
+    return;
+  }
+  uint value = max_depth - lsw + 1;
+  for (auto it = list_invbfs.begin() + begin; it != list_invbfs.begin() + end; ++it) {
+    refuted.insert(*it, value);
+  }
+}
+
+// Limited discrepancy probe run before the complete search, to lower max_depth
+// early. A branch is the next PROBE_WIDTH sets in the order of order_branches,
+// the first branch is followed for free and the i-th one costs i discrepancies.
+// Nothing is recorded as refuted, as the probe skips most of the sets.
+template<uint N, uint K>
+void Dfs<N, K>::probe_invdfs(size_t begin, size_t end, const uint64 lsw, const uint64 depth,
+    uint64 discrepancies) {
+  InterruptScope::check();
+  size_t initial_size = list_invbfs.size();
+
+  auto[found, next_begin, next_end] = invbfs_step_dfs<THREADS>(list_invbfs, begin, end, lsw, depth);
+  if (found) {
+#if FIND_WORD
+    save_meeting_set(list_invbfs, next_begin, next_end);
+#endif
+    max_depth = lsw;
+    if (max_depth > reset_threshold) {
+      remove_distant_bfs();
+      update_dfs_max_list_size();
+    }
+    Logger::verbose() << "(DFS) probe found length: " << (lsw + 1)
+                      << " new max depth: " << max_depth
+                      << " after " << note_found() << "ms";
+    list_invbfs.resize(initial_size);
+    return;
+  }
+
+  if (lsw + 1 < max_depth) {
+    order_branches(list_invbfs, next_begin, next_end);
+    for (uint64 i = 0; i <= discrepancies && lsw + 1 < max_depth; ++i) {
+      size_t branch_begin = next_begin + i * PROBE_WIDTH;
+      if (branch_begin >= next_end) {
+        break;
+      }
+      probe_invdfs(branch_begin, std::min(next_end, branch_begin + PROBE_WIDTH),
+          lsw + 1, depth + 1, discrepancies - i);
+    }
+  }
   list_invbfs.resize(initial_size);
 }
 
+// The branches are the consecutive parts of [begin, end), so the sets likely to
+// give a word should come first: by default by cardinality (as sorted by the
+// step), with DFS_ORDER_DENSITY by the chance that a set contains a trie_bfs set
+// if the states were independent, i.e. by the sum of the weights of the missing states.
+template<uint N, uint K>
+void Dfs<N, K>::order_branches([[maybe_unused]] FastVector<Subset<N>>& list,
+    [[maybe_unused]] size_t begin, [[maybe_unused]] size_t end) const {
+#ifdef DFS_ORDER_DENSITY
+  Timer timer("order");
+  FastVector<std::pair<double, size_t>> scores(end - begin);
+  for (size_t i = begin; i < end; ++i) {
+    auto missing = ~list[i];
+    double score = 0;
+    for (uint b = 0; b < Subset<N>::buckets(); b++) {
+      uint n = b * SUBSETS_BITS;
+      uint64 c = missing.v[b];
+      while (c) {
+        uint shift = __builtin_ctzll(c);
+        c >>= shift;
+        n += shift;
+        score += state_weights[n];
+        c ^= 1;
+      }
+    }
+    scores[i - begin] = {score, i};
+  }
+  std::stable_sort(scores.begin(), scores.end(),
+      [](const auto& a, const auto& b) { return a.first < b.first; });
+
+  FastVector<Subset<N>> ordered(end - begin);
+  for (size_t i = 0; i < scores.size(); ++i) {
+    ordered[i] = list[scores[i].second];
+  }
+  std::copy(ordered.begin(), ordered.end(), list.begin() + begin);
+#endif
+}
+
+// A state in a fraction f of the trie_bfs sets weighs -log(1 - f): a set missing
+// it can contain only the other 1 - f of them.
+template<uint N, uint K>
+void Dfs<N, K>::update_state_weights() {
+#ifdef DFS_ORDER_DENSITY
+  static constexpr double MAX_WEIGHT = 64;
+  SubsetsStats<N> stats(trie_bfs.subsets.begin(), trie_bfs.subsets.end());
+  state_weights.resize(N);
+  for (uint n = 0; n < N; ++n) {
+    double without = 1.0 - static_cast<double>(stats.frequency[n]) / std::max<uint64>(1, stats.count);
+    state_weights[n] = (without > 0 ? std::min(MAX_WEIGHT, -std::log(without)) : MAX_WEIGHT);
+  }
+#endif
+}
+
+template<uint N, uint K>
+size_t Dfs<N, K>::get_dfs_ms() const {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - dfs_start).count();
+}
+
+// counts a lowered bound, returns the time since the start of the DFS
+template<uint N, uint K>
+size_t Dfs<N, K>::note_found() {
+  last_found_ms = get_dfs_ms();
+  if (found_count++ == 0) {
+    first_found_ms = last_found_ms;
+  }
+  return last_found_ms;
+}
+
+// The branches of process_invdfs become tasks of a work-stealing pool. A task owns
+// a copy of its sets, a worker expands it in its own list (reused between tasks),
+// so the expanded sets need no synchronization, and pushes the branches as new
+// tasks, the first one on top. The steps are single-threaded, the parallelism
+// comes from the branches. A found word lowers max_depth for all workers at once,
+// the tasks that cannot give a shorter word are skipped. trie_bfs is read by all
+// workers, so it is not rebuilt by remove_distant_bfs. The queued copies and the
+// worker lists are counted by get_memory_usage.
+template<uint N, uint K>
+void Dfs<N, K>::process_invdfs_parallel() {
+  WorkStealingPool<Task> pool(workers);
+  FastVector<FastVector<Subset<N>>> lists(workers);
+  task_bytes = 0;
+  worker_list_bytes = 0;
+
+  auto push = [this, &pool] (uint worker, Task task) {
+    task_bytes += synchrolib::get_memory_usage(task.sets);
+    pool.push(worker, std::move(task));
+  };
+  auto release = [this] (Task& task) {
+    task_bytes -= synchrolib::get_memory_usage(task.sets);
+    task.sets = FastVector<Subset<N>>();
+  };
+
+  size_t chunk = (list_invbfs.size() + workers - 1) / workers;
+  for (uint worker = 0; worker < workers; ++worker) {
+    size_t begin = std::min(list_invbfs.size(), worker * chunk);
+    size_t end = std::min(list_invbfs.size(), begin + chunk);
+    if (begin != end) {
+      push(worker, Task{FastVector<Subset<N>>(list_invbfs.begin() + begin, list_invbfs.begin() + end),
+          reset_threshold, 0});
+    }
+  }
+  list_invbfs = FastVector<Subset<N>>();
+
+  pool.run([this, &push, &release, &lists] (Task& task, uint worker) {
+    if (task.lsw >= max_depth) {
+      release(task);
+      return;
+    }
+    InterruptScope::check();
+
+    auto& list = lists[worker];
+    size_t list_bytes = synchrolib::get_memory_usage(list);
+    list.assign(task.sets.begin(), task.sets.end());
+    size_t size = list.size();
+    release(task);
+
+    auto[found, next_begin, next_end] = invbfs_step_dfs<1>(list, 0, size, task.lsw, task.depth);
+    // added before subtracted, so a concurrent reader never sees less
+    worker_list_bytes += synchrolib::get_memory_usage(list);
+    worker_list_bytes -= list_bytes;
+    if (found) {
+      std::unique_lock<std::mutex> lock(found_mutex);
+      if (task.lsw < max_depth) {
+#if FIND_WORD
+        save_meeting_set(list, next_begin, next_end);
+#endif
+        max_depth = task.lsw;
+        if (max_depth > reset_threshold) {
+          update_dfs_max_list_size();
+        }
+        Logger::verbose() << "(DFS) found length: " << (task.lsw + 1)
+                          << " new max depth: " << max_depth
+                          << " new max list size " << dfs_max_list_size
+                          << " after " << note_found() << "ms";
+      }
+      return;
+    }
+
+    if (task.lsw + 1 >= max_depth) {
+      return;
+    }
+    order_branches(list, next_begin, next_end);
+
+    size_t next_size = next_end - next_begin;
+    size_t partsize = std::max<size_t>(dfs_max_list_size, size / 2);
+    size_t parts = (next_size + partsize - 1) / partsize;
+    Logger::verbose() << "(DFS) worker: " << worker << " length: " << (task.lsw + 1)
+                      << " list size: " << next_size << " branches: " << parts;
+
+    for (size_t part = parts; part-- > 0;) {
+      auto begin = list.begin() + next_begin + part * partsize;
+      auto end = list.begin() + std::min(next_end, next_begin + (part + 1) * partsize);
+      push(worker, Task{FastVector<Subset<N>>(begin, end), task.lsw + 1, task.depth + 1});
+    }
+  });
+  task_bytes = 0;
+  worker_list_bytes = 0;
+}
+
+// The inverse frontier is split into subproblems solved by forked processes. The
+// processes see the trie and the lists of the coordinator as they were at the fork
+// (copied on write), only the subproblem statuses and the bound are in shared
+// memory. A process claims the pending subproblems one by one, so a process that
+// crashed is detected by waitpid and its claimed subproblems are queued again for
+// a new process. The steps of a process use THREADS threads.
+template<uint N, uint K>
+void Dfs<N, K>::process_invdfs_processes() {
+  static constexpr uint MAX_RESTARTS = 8;
+  static constexpr auto WAIT_INTERVAL = std::chrono::milliseconds(10);
+
+  size_t count = std::min(list_invbfs.size(), processes * SUBPROBLEMS_PER_PROCESS);
+  FastVector<std::pair<size_t, size_t>> ranges;
+  for (size_t i = 0; i < count; ++i) {
+    ranges.push_back({list_invbfs.size() * i / count, list_invbfs.size() * (i + 1) / count});
+  }
+
+  SharedArray<std::atomic<int64>> status(count);
+  SharedArray<SharedBound> bound(1);
+  bound[0].max_depth = max_depth.load();
+  bound[0].meeting_lsw = std::numeric_limits<uint64>::max();
+
+  FastVector<pid_t> children;
+  auto spawn = [&] {
+    std::cout.flush();
+    std::cerr.flush();
+    pid_t pid = fork();
+    if (pid < 0) {
+      Logger::warning() << "(DFS) fork failed";
+      return;
+    }
+    if (pid == 0) {
+      int code = 0;
+      try {
+        shared_bound = &bound[0];
+        run_subproblems(status, ranges);
+      } catch (OutOfMemoryException& ex) {
+        code = EXIT_OUT_OF_MEMORY;
+      } catch (InterruptedException& ex) {
+        code = EXIT_INTERRUPTED;
+      }
+      std::cout.flush();
+      std::_Exit(code);
+    }
+    children.push_back(pid);
+  };
+
+  Logger::verbose() << "(DFS) processes: " << processes << " subproblems: " << count;
+  for (uint i = 0; i < processes; ++i) {
+    spawn();
+  }
+
+  uint restarts = 0;
+  bool out_of_memory = false;
+  bool interrupted = false;
+  bool forwarded = false;
+  while (!children.empty()) {
+    // the signal is passed on as soon as it is seen (also when it came between two
+    // waits), the processes stop as after their own signal
+    if (InterruptScope::signaled() && !forwarded) {
+      forwarded = true;
+      for (auto child : children) {
+        kill(child, SIGTERM);
+      }
+    }
+    int wstatus;
+    pid_t pid = waitpid(-1, &wstatus, WNOHANG);
+    if (pid == 0 || (pid < 0 && errno == EINTR)) {
+      std::this_thread::sleep_for(WAIT_INTERVAL);
+      continue;
+    }
+    if (pid < 0) {
+      break;
+    }
+    auto it = std::find(children.begin(), children.end(), pid);
+    if (it == children.end()) {
+      continue;
+    }
+    children.erase(it);
+
+    if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0) {
+      continue;
+    }
+    if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_OUT_OF_MEMORY) {
+      out_of_memory = true;
+      continue;
+    }
+    if (WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == EXIT_INTERRUPTED) {
+      interrupted = true;
+      continue;
+    }
+
+    size_t requeued = 0;
+    for (size_t i = 0; i < count; ++i) {
+      int64 owner = pid;
+      requeued += status[i].compare_exchange_strong(owner, PENDING);
+    }
+    int64 owner = pid;
+    bound[0].lock_owner.compare_exchange_strong(owner, 0);
+    Logger::warning() << "(DFS) process " << pid << " failed, subproblems queued again: " << requeued;
+    if (requeued && !out_of_memory && !interrupted && !InterruptScope::requested() && restarts < MAX_RESTARTS) {
+      restarts++;
+      spawn();
+    }
+  }
+
+  // the words found before a stop still give an upper bound
+  max_depth = std::min<uint64>(max_depth, bound[0].max_depth);
+  if (out_of_memory) {
+    throw OutOfMemoryException();
+  }
+  if (interrupted) {
+    throw InterruptedException();
+  }
+
+  // left by failed processes when no new process could take them
+  shared_bound = &bound[0];
+  run_subproblems(status, ranges);
+  shared_bound = nullptr;
+
+  max_depth = std::min<uint64>(max_depth, bound[0].max_depth);
+#if FIND_WORD
+  if (bound[0].meeting_lsw == max_depth) {
+    meeting_set = bound[0].meeting_set;
+    meeting_depth = bfs_depth;
+  }
+#endif
+  list_invbfs = FastVector<Subset<N>>();
+}
+
+template<uint N, uint K>
+void Dfs<N, K>::run_subproblems(SharedArray<std::atomic<int64>>& status, const FastVector<std::pair<size_t, size_t>>& ranges) {
+  int64 pid = getpid();
+  for (size_t i = 0; i < ranges.size(); ++i) {
+    int64 expected = PENDING;
+    if (!status[i].compare_exchange_strong(expected, pid)) {
+      continue;
+    }
+    sync_max_depth();
+    if (reset_threshold < max_depth) {
+      allocate_refuted();
+      process_invdfs(ranges[i].first, ranges[i].second, reset_threshold, 0);
+    }
+    status[i] = DONE;
+  }
+}
+
+// Serves the subproblems (ranges of the inverse frontier) to the workers connected
+// over TCP, see dfs_protocol.hpp. The workers get the permuted automaton, trie_bfs
+// and the frontier once, then a lease of one subproblem at a time. The leases of a
+// disconnected worker are queued again. When nothing is pending, the leases older
+// than LEASE_TIMEOUT are given to the idle workers as well, so a stalled worker
+// only delays the search. The snapshot (possibly gigabytes) is sent by a thread of
+// its worker, and any other send or receive making no progress for PEER_TIMEOUT
+// drops the worker, so one slow or dead peer never blocks the others. The
+// coordinator itself does not expand any sets, it warns every NO_WORKERS_WARNING
+// while no worker is connected.
+template<uint N, uint K>
+void Dfs<N, K>::process_invdfs_coordinator() {
+  static constexpr auto LEASE_TIMEOUT = std::chrono::seconds(60);
+  static constexpr auto NO_WORKERS_WARNING = std::chrono::seconds(60);
+  static constexpr auto PEER_TIMEOUT = std::chrono::seconds(10);
+  static constexpr size_t SUBPROBLEMS = 256;
+  static constexpr int POLL_MS = 1000;
+  static constexpr int64 NONE = -1;
+
+  struct Worker {
+    Socket socket;
+    bool idle = false;           // waits for a lease
+    uint64 bound = 0;            // the last max_depth sent
+    std::future<void> snapshot;  // valid while being sent, the socket is left to its thread
+  };
+  struct Subproblem {
+    size_t begin, end;
+    bool done = false;
+    int64 owner = NONE;  // worker of the last lease
+    Clock::time_point leased;
+  };
+
+  size_t count = std::min(list_invbfs.size(), SUBPROBLEMS);
+  std::vector<Subproblem> subproblems;
+  for (size_t i = 0; i < count; ++i) {
+    subproblems.push_back({list_invbfs.size() * i / count, list_invbfs.size() * (i + 1) / count, false, NONE, {}});
+  }
+  size_t remaining = count;
+  bool out_of_memory = false;
+
+  auto next_lease = [&]() -> std::optional<size_t> {
+    for (size_t i = 0; i < count; ++i) {
+      if (!subproblems[i].done && subproblems[i].owner == NONE) return i;
+    }
+    auto now = Clock::now();
+    for (size_t i = 0; i < count; ++i) {
+      if (!subproblems[i].done && now - subproblems[i].leased > LEASE_TIMEOUT) return i;
+    }
+    return std::nullopt;
+  };
+
+  std::map<int64, Worker> connections;
+  int64 next_id = 0;
+  std::vector<int64> lost;
+  auto send_bound = [&](int64 id, Worker& worker) {
+    if (worker.snapshot.valid() || worker.bound <= max_depth) {
+      return;
+    }
+    Socket& socket = worker.socket;
+    try {
+      socket.send(DfsMessage::BOUND);
+      socket.send<uint64>(max_depth);
+      worker.bound = max_depth;
+    } catch (SocketException& ex) {
+      lost.push_back(id);
+    }
+  };
+
+  auto handle = [&](int64 id, Worker& worker) {
+    Socket& socket = worker.socket;
+    switch (socket.recv<DfsMessage>()) {
+      case DfsMessage::READY:
+        worker.bound = max_depth;
+        worker.snapshot = std::async(std::launch::async, &Dfs::send_snapshot, this, std::ref(socket), worker.bound);
+        break;
+      case DfsMessage::REQUEST:
+        worker.idle = true;
+        break;
+      case DfsMessage::DONE: {
+        auto index = socket.recv<uint64>();
+        if (index >= count) {
+          throw SocketException("invalid subproblem " + std::to_string(index));
+        }
+        auto& subproblem = subproblems[index];
+        if (!subproblem.done) {
+          subproblem.done = true;
+          remaining--;
+        }
+        break;
+      }
+      case DfsMessage::FOUND: {
+        auto lsw = socket.recv<uint64>();
+        auto has_meeting_set = socket.recv<bool>();
+        auto set = socket.recv<Subset<N>>();
+        if (lsw < max_depth) {
+          max_depth = lsw;
+          if (has_meeting_set) {
+            meeting_set = set;
+            meeting_depth = bfs_depth;
+          }
+          Logger::verbose() << "(DFS) worker " << id << " found length: " << (lsw + 1)
+                            << " after " << note_found() << "ms";
+          for (auto& [other_id, other] : connections) {
+            send_bound(other_id, other);
+          }
+        }
+        break;
+      }
+      case DfsMessage::OUT_OF_MEMORY:
+        out_of_memory = true;
+        break;
+      default:
+        throw SocketException("unexpected message");
+    }
+  };
+
+  Socket listener = Socket::listen(DFS_COORDINATOR_PORT);
+  Logger::info() << "(DFS) waiting for workers on port " << DFS_COORDINATOR_PORT
+                 << " subproblems: " << count;
+
+  auto without_workers = Clock::now();  // since the last worker was connected
+  auto warned = without_workers;
+  while (remaining && reset_threshold < max_depth && !out_of_memory && !InterruptScope::requested()) {
+    auto now = Clock::now();
+    if (!connections.empty()) {
+      without_workers = warned = now;
+    } else if (now - warned >= NO_WORKERS_WARNING) {
+      warned = now;
+      Logger::warning() << "(DFS) no workers connected for "
+                        << std::chrono::duration_cast<std::chrono::seconds>(now - without_workers).count()
+                        << "s, subproblems remaining: " << remaining
+                        << ", start them with synchro --worker host:" << DFS_COORDINATOR_PORT;
+    }
+
+    for (auto& [id, worker] : connections) {
+      if (worker.snapshot.valid() &&
+          worker.snapshot.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        try {
+          worker.snapshot.get();
+          Logger::verbose() << "(DFS) worker " << id << " ready";
+          send_bound(id, worker);
+        } catch (SocketException& ex) {
+          Logger::warning() << "(DFS) worker " << id << ": " << ex.what();
+          lost.push_back(id);
+        }
+      }
+    }
+
+    for (auto& [id, worker] : connections) {
+      auto index = (worker.idle ? next_lease() : std::nullopt);
+      if (!index) {
+        continue;
+      }
+      auto& subproblem = subproblems[*index];
+      Socket& socket = worker.socket;
+      try {
+        socket.send(DfsMessage::LEASE);
+        socket.send<uint64>(*index);
+        socket.send<uint64>(subproblem.begin);
+        socket.send<uint64>(subproblem.end);
+        worker.idle = false;
+        subproblem.owner = id;
+        subproblem.leased = Clock::now();
+      } catch (SocketException& ex) {
+        lost.push_back(id);
+      }
+    }
+
+    std::vector<pollfd> fds{{listener.get_fd(), POLLIN, 0}};
+    std::vector<int64> ids;
+    for (auto& [id, worker] : connections) {
+      if (!worker.snapshot.valid()) {
+        fds.push_back({worker.socket.get_fd(), POLLIN, 0});
+        ids.push_back(id);
+      }
+    }
+    if (poll(fds.data(), fds.size(), POLL_MS) < 0 && errno != EINTR) {
+      throw SocketException("poll failed");
+    }
+
+    if (fds[0].revents & POLLIN) {
+      try {
+        Socket socket = listener.accept();
+        socket.set_timeout(PEER_TIMEOUT);
+        socket.send(DfsMessage::JOB);
+        socket.send<uint>(N);
+        socket.send<uint>(K);
+        Worker worker;
+        worker.socket = std::move(socket);
+        Logger::verbose() << "(DFS) worker " << next_id << " connected";
+        connections.emplace(next_id++, std::move(worker));
+      } catch (SocketException& ex) {
+        Logger::warning() << "(DFS) " << ex.what();
+      }
+    }
+    for (size_t i = 1; i < fds.size(); ++i) {
+      if (!fds[i].revents) {
+        continue;
+      }
+      try {
+        handle(ids[i - 1], connections.at(ids[i - 1]));
+      } catch (SocketException& ex) {
+        Logger::warning() << "(DFS) worker " << ids[i - 1] << ": " << ex.what();
+        lost.push_back(ids[i - 1]);
+      }
+    }
+
+    for (auto id : lost) {
+      auto it = connections.find(id);
+      if (it == connections.end()) {
+        continue;
+      }
+      it->second.socket.shutdown();  // a thread still sending the snapshot returns
+      connections.erase(it);
+      size_t requeued = 0;
+      for (auto& subproblem : subproblems) {
+        if (!subproblem.done && subproblem.owner == id) {
+          subproblem.owner = NONE;
+          requeued++;
+        }
+      }
+      Logger::warning() << "(DFS) worker " << id << " lost, subproblems queued again: " << requeued;
+    }
+    lost.clear();
+  }
+
+  for (auto& [id, worker] : connections) {
+    if (worker.snapshot.valid()) {
+      worker.socket.shutdown();
+      continue;
+    }
+    try {
+      worker.socket.send(DfsMessage::FINISHED);
+    } catch (SocketException& ex) {
+    }
+  }
+  connections.clear();  // the snapshot threads are joined before the frontier is released
+  if (out_of_memory) {
+    throw OutOfMemoryException();
+  }
+  InterruptScope::check();
+  list_invbfs = FastVector<Subset<N>>();
+}
+
+// SNAPSHOT of dfs_protocol.hpp, with the bound max_depth
+template<uint N, uint K>
+void Dfs<N, K>::send_snapshot(Socket& socket, uint64 bound) const {
+  socket.send(DfsMessage::SNAPSHOT);
+  socket.send_string(aut.encode());
+  socket.send<uint64>(reset_threshold);
+  socket.send<uint64>(bound);
+  socket.send<uint64>(bfs_depth);
+  socket.send<uint64>(max_memory);
+  socket.send_range(trie_bfs.subsets.begin(), trie_bfs.subsets.end());
+  socket.send_range(list_invbfs.begin(), list_invbfs.end());
+}
+
+template<uint N, uint K>
+void Dfs<N, K>::run_worker(Socket& socket) {
+  try {
+    socket.send(DfsMessage::READY);
+    if (socket.recv<DfsMessage>() != DfsMessage::SNAPSHOT) {
+      throw SocketException("unexpected message");
+    }
+    // at most 10 digits and a space per transition, the sets within max_memory_mb of the worker
+    auto aut = Automaton<N, K>::decode(socket.recv_string(11 * N * K));
+    auto reset_threshold = socket.recv<uint64>();
+    auto max_depth = socket.recv<uint64>();
+    auto bfs_depth = socket.recv<uint64>();
+    // the lists and the cache are budgeted for the memory of both machines
+    size_t local_memory = static_cast<size_t>(MAX_MEMORY) * 1024 * 1024;
+    size_t max_memory = std::min<size_t>(local_memory, socket.recv<uint64>());
+    size_t max_sets = local_memory / sizeof(Subset<N>);
+    auto sets_bfs = socket.recv_vector<Subset<N>>(max_sets);
+    auto list_invbfs = socket.recv_vector<Subset<N>>(max_sets - sets_bfs.size());
+    size_t frontier_size = list_invbfs.size();
+
+    InverseAutomaton<N, K> invaut(aut);
+    std::array<PreprocessedTransition<N, K>, K> ptrans;
+    std::array<PreprocessedTransition<N, K>, K> invptrans;
+    for (uint k = 0; k < K; k++) {
+      ptrans[k] = PreprocessedTransition<N, K>(aut, k);
+      invptrans[k] = PreprocessedTransition<N, K>(invaut, k);
+    }
+    FastVector<Subset<N>> list_bfs;
+    SubsetsStats<N> stats_bfs;
+    SubsetsStats<N> stats_invbfs;
+
+    Dfs<N, K> dfs(aut, invaut, ptrans, invptrans, reset_threshold, list_bfs, stats_bfs,
+        bfs_depth, list_invbfs, stats_invbfs, max_depth, max_memory, false);
+    dfs.coordinator = &socket;
+    dfs.workers = dfs.processes = 1;
+    dfs.build_trie_bfs(std::move(sets_bfs));
+    dfs.pairs_bound.initialize(aut);
+    dfs.remove_distant_bfs();
+    dfs.update_state_weights();
+    dfs.plan_refuted();
+    dfs.update_dfs_max_list_size();
+    Logger::info() << "(DFS worker) frontier size: " << list_invbfs.size()
+                   << " max list size: " << dfs.dfs_max_list_size;
+
+    while (true) {
+      socket.send(DfsMessage::REQUEST);
+      auto message = socket.recv<DfsMessage>();
+      while (message == DfsMessage::BOUND) {
+        dfs.max_depth = std::min<uint64>(dfs.max_depth, socket.recv<uint64>());
+        message = socket.recv<DfsMessage>();
+      }
+      if (message == DfsMessage::FINISHED) {
+        break;
+      }
+      if (message != DfsMessage::LEASE) {
+        throw SocketException("unexpected message");
+      }
+
+      auto index = socket.recv<uint64>();
+      auto begin = socket.recv<uint64>();
+      auto end = socket.recv<uint64>();
+      if (begin > end || end > frontier_size) {
+        throw SocketException("invalid subproblem " + std::to_string(index));
+      }
+      dfs.sync_max_depth();
+      if (reset_threshold < dfs.max_depth) {
+        Logger::verbose() << "(DFS worker) subproblem " << index;
+        dfs.allocate_refuted();
+        dfs.process_invdfs(begin, end, reset_threshold, 0);
+      }
+      socket.send(DfsMessage::DONE);
+      socket.send<uint64>(index);
+    }
+  } catch (OutOfMemoryException& ex) {
+    Logger::error() << "(DFS worker) out of memory";
+    try {
+      socket.send(DfsMessage::OUT_OF_MEMORY);
+    } catch (SocketException& ex) {
+    }
+  } catch (DfsFinishedException& ex) {
+    Logger::verbose() << "(DFS worker) finished during a subproblem";
+  } catch (SocketException& ex) {
+    Logger::warning() << "(DFS worker) " << ex.what();
+  }
+}
+
+// the bound lowered by the other processes or workers
+template<uint N, uint K>
+void Dfs<N, K>::sync_max_depth() {
+  if (shared_bound && shared_bound->max_depth < max_depth) {
+    max_depth = shared_bound->max_depth.load();
+  }
+  // only BOUND and FINISHED are sent to a worker that does not wait for a lease
+  while (coordinator && coordinator->readable()) {
+    auto message = coordinator->recv<DfsMessage>();
+    if (message == DfsMessage::FINISHED) {
+      throw DfsFinishedException();
+    }
+    if (message != DfsMessage::BOUND) {
+      throw SocketException("unexpected message");
+    }
+    max_depth = std::min<uint64>(max_depth, coordinator->recv<uint64>());
+  }
+}
+
+template<uint N, uint K>
+void Dfs<N, K>::publish_found(uint64 lsw) {
+  if (coordinator) {
+    coordinator->send(DfsMessage::FOUND);
+    coordinator->send(lsw);
+    coordinator->send(meeting_set.has_value());
+    coordinator->send(meeting_set.value_or(Subset<N>::Empty()));
+  }
+  if (!shared_bound) {
+    return;
+  }
+
+  int64 pid = getpid();
+  int64 expected = 0;
+  while (!shared_bound->lock_owner.compare_exchange_weak(expected, pid)) {
+    expected = 0;
+    std::this_thread::yield();
+  }
+#if FIND_WORD
+  if (meeting_set && lsw < shared_bound->meeting_lsw) {
+    shared_bound->meeting_set = *meeting_set;
+    shared_bound->meeting_lsw = lsw;
+  }
+#endif
+  if (lsw < shared_bound->max_depth) {
+    shared_bound->max_depth = lsw;
+  }
+  shared_bound->lock_owner = 0;
+}
+
+// With DFS_TRIE_DIR the image of trie_bfs is saved there after a build, named by
+// the hash of the sets, and mapped instead of built when the same sets come again
+// (a repeated run, or the TCP workers on one machine, which then share its pages).
+// The directory has to exist and the images are never removed; an image takes about
+// the memory of the trie.
+template<uint N, uint K>
+void Dfs<N, K>::build_trie_bfs(FastVector<Subset<N>> list) {
+  std::string dir = DFS_TRIE_DIR;
+  if (dir.empty()) {
+    trie_bfs.template build<true>(std::move(list));
+    return;
+  }
+
+  std::stringstream path;
+  path << dir << "/trie_bfs_" << N << "_" << std::hex
+       << data_checksum(list.data(), list.size() * sizeof(Subset<N>)) << ".bin";
+  if (trie_bfs.load(path.str())) {
+    Logger::verbose() << "(DFS) trie mapped from " << path.str();
+    return;
+  }
+
+  trie_bfs.template build<true>(std::move(list));
+  try {
+    trie_bfs.save(path.str());
+    Logger::verbose() << "(DFS) trie saved to " << path.str();
+  } catch (const std::runtime_error& e) {
+    Logger::warning() << "(DFS) " << e.what();
+  }
+}
+
+// The trie_bfs sets with a pair more distant than the remaining steps cannot be
+// met within max_depth. The trie is rebuilt when the bound drops some set, which
+// happens when a shorter word lowers max_depth. The inverse sets need no check,
+// their pairs merge within their depth by construction.
+template<uint N, uint K>
+void Dfs<N, K>::remove_distant_bfs() {
+  pairs_bound.set_budget(max_depth - bfs_depth);
+  auto exceeds = [this](const Subset<N>& sub) { return pairs_bound.exceeds(sub); };
+  if (!pairs_bound.prunes() || std::none_of(trie_bfs.subsets.begin(), trie_bfs.subsets.end(), exceeds)) {
+    return;
+  }
+
+  Timer timer("pairs bound");
+  FastVector<Subset<N>> list(trie_bfs.subsets.begin(), trie_bfs.subsets.end());
+  list.erase(std::remove_if(list.begin(), list.end(), exceeds), list.end());
+  Logger::verbose() << "(DFS) pairs bound | remaining steps: " << (max_depth - bfs_depth)
+                    << " removed: " << (trie_bfs.get_sets_count() - list.size());
+  trie_bfs.template build<true>(std::move(list));
+}
+
+// Mirror of process_invdfs, the forward images are expanded (list_bfs is the stack)
+// and checked against the indexed list_invbfs. Used when the forward side grows
+// slower, e.g. after Reduce.
+template<uint N, uint K>
+void Dfs<N, K>::process_dfs(size_t begin, size_t end, const uint64 lsw, const uint64 depth) {
+  InterruptScope::check();
+  size_t initial_size = list_bfs.size();
+  size_t size = end - begin;
+  const uint64 bfs_steps = bfs_depth + depth + 1;
+
+  auto[found, next_begin, next_end] = bfs_step_dfs(begin, end, lsw, depth);
+  if (found) {
+#if FIND_WORD
+    save_forward_meeting_set(next_begin, next_end, bfs_steps);
+#endif
+    max_depth = lsw;
+    if (max_depth > reset_threshold) {
+      update_dfs_max_list_size();
+    }
+    Logger::verbose() << "(DFS) found length: " << (lsw + 1)
+                      << " new max depth: " << max_depth
+                      << " new max list size " << dfs_max_list_size
+                      << " after " << note_found() << "ms";
+    list_bfs.resize(initial_size);
+    return;
+  }
+
+  if (lsw + 1 >= max_depth) {
+    list_bfs.resize(initial_size);
+    return;
+  }
+
+  size_t next_size = next_end - next_begin;
+
+  size_t partsize = std::max<size_t>(dfs_max_list_size, size / 2);
+  Logger::verbose() << "(DFS) length: " << (lsw + 1)
+                    << " list size: " << next_size << " branches: "
+                    << (next_size ? (next_size - 1) / partsize + 1 : 0)
+                    << " memory usage: " << get_megabytes(get_memory_usage());
+
+  size_t pos = 0;
+  while (pos + partsize < next_size) {
+    process_dfs(next_begin + pos,
+        next_begin + (pos + partsize), lsw + 1, depth + 1);
+    if (lsw + 1 >= max_depth) {
+      list_bfs.resize(initial_size);
+      return;
+    }
+    pos += partsize;
+    partsize = std::max<size_t>(dfs_max_list_size, size / 2);
+  }
+  process_dfs(next_begin + pos, next_end, lsw + 1, depth + 1);
+  list_bfs.resize(initial_size);
+}
+
+template<uint N, uint K>
+void Dfs<N, K>::save_meeting_set(FastVector<Subset<N>>& list, size_t begin, size_t end) {
+  for (auto it = list.begin() + begin; it != list.begin() + end; ++it) {
+    if (!trie_bfs.contains_subset_of(it, std::next(it))) {
+      continue;
+    }
+    for (const auto& sub : trie_bfs.subsets) {
+      if (it->is_subset(sub)) {
+        meeting_set = sub;
+        meeting_depth = bfs_depth;
+        return;
+      }
+    }
+  }
+}
+
+// The forward sets at bfs_steps are contained in some inverse set iff the negated
+// ones contain a trie_invbfs set.
+template<uint N, uint K>
+void Dfs<N, K>::save_forward_meeting_set(size_t begin, size_t end, uint64 bfs_steps) {
+  for (auto it = list_bfs.begin() + begin; it != list_bfs.begin() + end; ++it) {
+    auto complement = *it;
+    complement.negate();
+    if (trie_invbfs.contains_subset_of(&complement, &complement + 1)) {
+      meeting_set = *it;
+      meeting_depth = bfs_steps;
+      return;
+    }
+  }
+}
+
 template<uint N, uint K>
 typename Dfs<N, K>::cost_t Dfs<N, K>::get_trie_evn(const cost_t m, const cost_t p, const cost_t q) {
-  cost_t e = ((1.0 + p) / p + 1.0 / (q - p * q)) *
-      std::pow(m, std::log(1.0 + p) / std::log((1.0 + p) / (1.0 + p * q - q)));
-  if (e >= 0 && e < m * N) return e;
-  return m * N;
+  return synchrolib::get_trie_evn<N>(m, p, q);
 }
 
+// Expands [begin, end) of list at its end, with Threads threads. The reductions
+// are chosen by should_reduce from their observed effect at this depth.
 template<uint N, uint K>
-std::tuple<bool, size_t, size_t> Dfs<N, K>::invbfs_step_dfs(size_t begin, size_t end, bool reduce_duplicates, size_t reduce_subsets) {
+template<uint Threads>
+std::tuple<bool, size_t, size_t> Dfs<N, K>::invbfs_step_dfs(FastVector<Subset<N>>& list,
+    size_t begin, size_t end, const uint64 lsw, const uint64 depth) {
+  auto step_start = Clock::now();
+  Clock::duration reductions_time{};
+  uint64 remaining = max_depth - std::min<uint64>(max_depth, lsw + 1);  // expansions left to the next sets
+  Reduction duplicates;
+  Reduction subsets;
+  {
+    std::unique_lock<std::mutex> lock(reduction_mutex);
+    if (reduction_history.size() <= depth) {
+      reduction_history.resize(depth + 1);
+    }
+    duplicates = should_reduce(reduction_history[depth].duplicates, remaining);
+    subsets = should_reduce(reduction_history[depth].subsets, remaining);
+  }
+  bool reduce_duplicates = (duplicates != Reduction::SKIP);
+
   Timer reserve("reserve");
-  size_t next_begin = list_invbfs.size();
-  list_invbfs.resize(list_invbfs.size() + K * (end - begin));
-  size_t next_end = list_invbfs.size();
+  size_t next_begin = list.size();
+  list.resize(list.size() + K * (end - begin));
+  size_t next_end = list.size();
   reserve.stop();
 
   Timer timer("apply");
   for (uint k = 0; k < K; k++) {
-    invptrans[k].apply(list_invbfs.data() + begin,
-      list_invbfs.data() + (next_begin + k * (end - begin)),
+    invptrans[k].apply(list.data() + begin,
+      list.data() + (next_begin + k * (end - begin)),
       end - begin);
   }
   timer.stop();
 
-  if (reduce_subsets) {
-    Timer reduce_timer("reduce");
-    auto vec = FastVector<Subset<N>>(list_invbfs.begin() + next_begin, list_invbfs.begin() + next_end);
+  if (!refuted.empty()) {
+    Timer refuted_timer("refuted");
+    auto it = std::remove_if(list.begin() + next_begin, list.begin() + next_end,
+        [this, remaining](const Subset<N>& sub) { return refuted.get(sub) > remaining; });
+    Logger::debug() << "Refuted " << std::distance(it, list.begin() + next_end);
+    next_end = std::distance(list.begin(), it);
+    list.resize(next_end);
+  }
+  size_t expanded = next_end - next_begin;
 
-    for (auto& sub : vec) sub.negate();
-    auto red = FastVector<Subset<N>>(vec.begin(), vec.begin() + std::min(vec.size(), reduce_subsets));
+  // a measurement reduces only the last REDUCTION_SAMPLE sets
+  size_t subsets_checked = (subsets == Reduction::MEASURE ? std::min(expanded, REDUCTION_SAMPLE) : expanded);
+  size_t reduced_subsets = 0;
+  if (subsets != Reduction::SKIP) {
+    Timer reduce_timer("reduce");
+    auto reduce_start = Clock::now();
+    // the sets contained in one of the first SUBSETS_REDUCERS sets are removed in place,
+    // the trie reads both as complements (no negation)
+    auto red = FastVector<Subset<N>>(list.begin() + next_begin,
+        list.begin() + next_begin + std::min(next_end - next_begin, SUBSETS_REDUCERS));
     Logger::debug() << "red size " << red.size();
-    Logger::debug() << "before " << vec.size();
-    SubsetsImplicitTrie<N, true, THREADS>::reduce(red, vec);
-    Logger::debug() << "after " << vec.size();
-    for (auto& sub : vec) sub.negate();
+    Logger::debug() << "before " << next_end - next_begin;
+    auto it = SubsetsImplicitTrie<N, true, Threads, false, true>::reduce(
+        red, list.begin() + (next_end - subsets_checked), list.begin() + next_end);
+    reduced_subsets = next_end - std::distance(list.begin(), it);
+    next_end = std::distance(list.begin(), it);
+    Logger::debug() << "after " << next_end - next_begin;
 
-    std::copy(vec.begin(), vec.end(), list_invbfs.begin() + next_begin);
-    next_end = next_begin + vec.size();
-    list_invbfs.resize(next_end);
+    list.resize(next_end);
+    reductions_time += Clock::now() - reduce_start;
+    reduce_timer.stop();
+  }
+  auto subsets_time = reductions_time;
 
+  Timer sort_timer("sort");
+  FastVector<std::pair<Iterator, Iterator>> segments(N + 1);
+  sort_sets_cardinality_descending<N>(
+      list.begin() + next_begin,
+      list.begin() + next_end,
+      [&segments, &reductions_time, reduce_duplicates] (auto begin, auto end, uint card) {
+        segments[card] = {begin, end};
+        if (!reduce_duplicates || begin == end) {
+          return;
+        }
+
+        auto sort_start = Clock::now();
+        if constexpr (Threads == 1) {
+          std::sort(begin, end, Subset<N>::comp_fast);
+        } else {
+          parallel_sort(
+            std::addressof(*begin),
+            std::distance(begin, end),
+            std::max(static_cast<size_t>(256), (static_cast<size_t>(std::distance(begin, end)) + Threads - 1) / Threads),
+            Subset<N>::comp_fast);
+        }
+        reductions_time += Clock::now() - sort_start;
+      });
+  list.resize(std::distance(list.begin(), segments[1].first));
+  Logger::debug() << "Deleted " << next_end - list.size() << " sets of cardinality <= 1";
+  next_end = list.size();
+  sort_timer.stop();
+
+  size_t reduced_duplicates = 0;
+  if (reduce_duplicates) {
+    Timer duplicates_timer("remove duplicates");
+    auto duplicates_start = Clock::now();
+    reduced_duplicates = next_end - next_begin;
+    next_end = next_begin + std::distance(
+      list.begin() + next_begin,
+      std::unique(list.begin() + next_begin, list.begin() + next_end));
+    reduced_duplicates -= next_end - next_begin;
+    list.resize(next_end);
+
+    auto lo = list.begin() + next_begin;
+    auto end = list.begin() + next_end;
+    for (uint sz = N; sz >= 2; --sz) {
+      segments[sz].first = lo;
+      auto hi = lo;
+      while (hi != end && hi->size() == sz) {
+        ++hi;
+      }
+      segments[sz] = {lo, hi};
+      lo = hi;
+    }
+    reductions_time += Clock::now() - duplicates_start;
+  }
+
+  Timer timer_sc("subsets check");
+  bool found = segments_contain_subset<Threads>(trie_bfs, segments, 2, next_end - next_begin);
+  timer_sc.stop();
+
+  if (expanded) {
+    auto ns = [](Clock::duration d) { return static_cast<double>(std::chrono::nanoseconds(d).count()); };
+    std::unique_lock<std::mutex> lock(reduction_mutex);
+    auto& history = reduction_history[depth];
+    if (subsets != Reduction::SKIP) {
+      history.subsets.update(static_cast<double>(reduced_subsets) / subsets_checked,
+          ns(subsets_time) / subsets_checked);
+    }
+    if (reduce_duplicates) {
+      history.duplicates.update(static_cast<double>(reduced_duplicates) / expanded,
+          ns(reductions_time - subsets_time) / expanded);
+    }
+    if (begin != end) {
+      double step = ns(Clock::now() - step_start - reductions_time) / (end - begin);
+      step_ns = (step_ns == 0 ? step : (1 - HISTORY_WEIGHT) * step_ns + HISTORY_WEIGHT * step);
+    }
+  }
+  return {found, next_begin, next_end};
+}
+
+// A reduction pays for itself if the sets it removes would cost more in the
+// subtree below, at least one step per remaining expansion, than the reduction
+// itself. Each reduction is measured during the first calls at a depth and then
+// once per REDUCTION_PROBE_PERIOD calls, so that the decision follows the
+// changing lists. Called with reduction_mutex held.
+template<uint N, uint K>
+typename Dfs<N, K>::Reduction Dfs<N, K>::should_reduce(ReductionHistory& history, uint64 remaining) const {
+  if (remaining == 0) {
+    return Reduction::SKIP;  // the next sets are not expanded
+  }
+  bool pays = history.samples && history.reduced * step_ns * remaining > history.ns;
+  if (history.samples < REDUCTION_MIN_SAMPLES || ++history.skipped >= REDUCTION_PROBE_PERIOD) {
+    return (pays ? Reduction::APPLY : Reduction::MEASURE);
+  }
+  return (pays ? Reduction::APPLY : Reduction::SKIP);
+}
+
+// The forward images are reduced as in BFS (supersets of the first SUBSETS_REDUCERS
+// sets are dropped), then negated for the check: an inverse set contains an image
+// iff its complement (a trie_invbfs set) is contained in the negated image. They are
+// negated back afterwards, and sets exceeding the pairs bound at bfs_steps are dropped.
+// The reductions are chosen by should_reduce as in invbfs_step_dfs.
+template<uint N, uint K>
+std::tuple<bool, size_t, size_t> Dfs<N, K>::bfs_step_dfs(
+    size_t begin, size_t end, const uint64 lsw, const uint64 depth) {
+  auto step_start = Clock::now();
+  Clock::duration reductions_time{};
+  const uint64 bfs_steps = bfs_depth + depth + 1;
+  uint64 remaining = max_depth - std::min<uint64>(max_depth, lsw + 1);
+  Reduction duplicates;
+  Reduction subsets;
+  {
+    std::unique_lock<std::mutex> lock(reduction_mutex);
+    if (reduction_history.size() <= depth) {
+      reduction_history.resize(depth + 1);
+    }
+    duplicates = should_reduce(reduction_history[depth].duplicates, remaining);
+    subsets = should_reduce(reduction_history[depth].subsets, remaining);
+  }
+  bool reduce_duplicates = (duplicates != Reduction::SKIP);
+
+  Timer reserve("reserve");
+  size_t next_begin = list_bfs.size();
+  list_bfs.resize(list_bfs.size() + K * (end - begin));
+  size_t next_end = list_bfs.size();
+  reserve.stop();
+
+  Timer timer("apply");
+  for (uint k = 0; k < K; k++) {
+    ptrans[k].apply(list_bfs.data() + begin,
+      list_bfs.data() + (next_begin + k * (end - begin)),
+      end - begin);
+  }
+  timer.stop();
+
+  pairs_bound.set_budget(max_depth - bfs_steps);
+  if (pairs_bound.prunes()) {
+    Timer pairs_timer("pairs bound");
+    auto it = std::remove_if(list_bfs.begin() + next_begin, list_bfs.begin() + next_end,
+        [this](const Subset<N>& sub) { return pairs_bound.exceeds(sub); });
+    next_end = std::distance(list_bfs.begin(), it);
+    list_bfs.resize(next_end);
+  }
+
+  size_t expanded = next_end - next_begin;
+
+  // a measurement reduces only the last REDUCTION_SAMPLE sets
+  size_t subsets_checked = (subsets == Reduction::MEASURE ? std::min(expanded, REDUCTION_SAMPLE) : expanded);
+  size_t reduced_subsets = 0;
+  if (subsets != Reduction::SKIP) {
+    Timer reduce_timer("reduce");
+    auto reduce_start = Clock::now();
+    auto red = FastVector<Subset<N>>(list_bfs.begin() + next_begin,
+        list_bfs.begin() + next_begin + std::min(next_end - next_begin, SUBSETS_REDUCERS));
+    auto it = SubsetsImplicitTrie<N, true, THREADS>::reduce(
+        red, list_bfs.begin() + (next_end - subsets_checked), list_bfs.begin() + next_end);
+    reduced_subsets = next_end - std::distance(list_bfs.begin(), it);
+    next_end = std::distance(list_bfs.begin(), it);
+    list_bfs.resize(next_end);
+    reductions_time += Clock::now() - reduce_start;
     reduce_timer.stop();
   }
+  auto subsets_time = reductions_time;
 
   Timer sort_timer("sort");
-  static FastVector<std::pair<Iterator, Iterator>> segments;
+  for (auto it = list_bfs.begin() + next_begin; it != list_bfs.begin() + next_end; ++it) {
+    it->negate();
+  }
+  auto& segments = bfs_segments;
   segments.resize(N+1);
   sort_sets_cardinality_descending<N>(
-      list_invbfs.begin() + next_begin,
-      list_invbfs.begin() + next_end,
-      [reduce_duplicates] (auto begin, auto end, uint card) {
+      list_bfs.begin() + next_begin,
+      list_bfs.begin() + next_end,
+      [&segments, &reductions_time, reduce_duplicates] (auto begin, auto end, uint card) {
         segments[card] = {begin, end};
         if (!reduce_duplicates || begin == end) {
           return;
         }
 
+        auto sort_start = Clock::now();
         if constexpr (THREADS == 1) {
           std::sort(begin, end, Subset<N>::comp_fast);
         } else {
@@ -281,23 +1465,24 @@ std::tuple<bool, size_t, size_t> Dfs<N, K>::invbfs_step_dfs(size_t begin, size_t
             std::max(static_cast<size_t>(256), (static_cast<size_t>(std::distance(begin, end)) + THREADS - 1) / THREADS),
             Subset<N>::comp_fast);
         }
+        reductions_time += Clock::now() - sort_start;
       });
-  list_invbfs.resize(std::distance(list_invbfs.begin(), segments[1].first));
-  Logger::debug() << "Deleted " << next_end - list_invbfs.size() << " sets of cardinality <= 1";
-  next_end = list_invbfs.size();
   sort_timer.stop();
 
+  size_t reduced_duplicates = 0;
   if (reduce_duplicates) {
     Timer duplicates_timer("remove duplicates");
+    auto duplicates_start = Clock::now();
+    reduced_duplicates = next_end - next_begin;
     next_end = next_begin + std::distance(
-      list_invbfs.begin() + next_begin,
-      std::unique(list_invbfs.begin() + next_begin, list_invbfs.begin() + next_end));
-    list_invbfs.resize(next_end);
+      list_bfs.begin() + next_begin,
+      std::unique(list_bfs.begin() + next_begin, list_bfs.begin() + next_end));
+    reduced_duplicates -= next_end - next_begin;
+    list_bfs.resize(next_end);
 
-    auto lo = list_invbfs.begin() + next_begin;
-    auto end = list_invbfs.begin() + next_end;
-    for (uint sz = N; sz >= 2; --sz) {
-      segments[sz].first = lo;
+    auto lo = list_bfs.begin() + next_begin;
+    auto end = list_bfs.begin() + next_end;
+    for (uint sz = N + 1; sz-- > 0;) {
       auto hi = lo;
       while (hi != end && hi->size() == sz) {
         ++hi;
@@ -305,50 +1490,84 @@ std::tuple<bool, size_t, size_t> Dfs<N, K>::invbfs_step_dfs(size_t begin, size_t
       segments[sz] = {lo, hi};
       lo = hi;
     }
+    reductions_time += Clock::now() - duplicates_start;
   }
 
   Timer timer_sc("subsets check");
-  if (THREADS > 1 && next_end - next_begin > 32) {
-    ThreadPool pool;
-    pool.start(THREADS);
+  bool found = segments_contain_subset<THREADS>(trie_invbfs, segments, 0, next_end - next_begin);
+  timer_sc.stop();
 
+  if (expanded) {
+    auto ns = [](Clock::duration d) { return static_cast<double>(std::chrono::nanoseconds(d).count()); };
+    std::unique_lock<std::mutex> lock(reduction_mutex);
+    auto& history = reduction_history[depth];
+    if (subsets != Reduction::SKIP) {
+      history.subsets.update(static_cast<double>(reduced_subsets) / subsets_checked,
+          ns(subsets_time) / subsets_checked);
+    }
+    if (reduce_duplicates) {
+      history.duplicates.update(static_cast<double>(reduced_duplicates) / expanded,
+          ns(reductions_time - subsets_time) / expanded);
+    }
+    if (begin != end) {
+      double step = ns(Clock::now() - step_start - reductions_time) / (end - begin);
+      step_ns = (step_ns == 0 ? step : (1 - HISTORY_WEIGHT) * step_ns + HISTORY_WEIGHT * step);
+    }
+  }
+
+  for (auto it = list_bfs.begin() + next_begin; it != list_bfs.begin() + next_end; ++it) {
+    it->negate();
+  }
+  return {found, next_begin, next_end};
+}
+
+// whether some query set of size at least min_size (grouped by the size in segments)
+// contains a subset from trie, the segments are checked in parallel if there are enough sets
+template<uint N, uint K>
+template<uint Threads>
+bool Dfs<N, K>::segments_contain_subset(const SubsetsTrie<N, THREADS>& trie,
+    const FastVector<std::pair<Iterator, Iterator>>& segments, uint min_size, size_t count) const {
+  if (Threads > 1 && count > 32) {
+    TaskGroup group;
     std::atomic<bool> ret = false;
-    for (uint sz = N; sz >= 2; --sz) {
+    for (uint sz = N + 1; sz-- > min_size;) {
       auto [lo, hi] = segments[sz];
       if (lo == hi) {
         continue;
       }
 
-      auto job = [this, lo, hi, &ret] {
-        if (this->trie_bfs.contains_subset_of(lo, hi)) {
+      // once any segment finds a subset, the remaining jobs are cancelled
+      auto job = [&trie, lo, hi, &ret] {
+        if (!ret.load(std::memory_order_relaxed) && trie.contains_subset_of(lo, hi, &ret)) {
           ret = true;
         }
       };
-      pool.add_job(job);
+      group.run(job);
     }
+    group.wait();
 
-    pool.wait();
-
-    return {ret.load(), next_begin, next_end};
+    return ret.load();
   }
 
-  for (uint sz = N; sz >= 2; --sz) {
+  for (uint sz = N + 1; sz-- > min_size;) {
     auto [lo, hi] = segments[sz];
     if (lo == hi) {
       continue;
     }
 
-    if (trie_bfs.contains_subset_of(lo, hi)) {
-      return {true, next_begin, next_end};
+    if (trie.contains_subset_of(lo, hi)) {
+      return true;
     }
   }
 
-  return {false, next_begin, next_end};
+  return false;
 }
 
 template<uint N, uint K>
 void Dfs<N, K>::update_dfs_max_list_size() {
-  auto memory_usage = get_memory_usage();
+  // refuted once per process, also before it is allocated
+  auto memory_usage = get_memory_usage() - synchrolib::get_memory_usage(refuted) +
+      refuted_bytes * processes;
   if (max_memory < memory_usage) {
 #if STRICT_MEMORY_LIMIT
     throw OutOfMemoryException();
@@ -356,10 +1575,11 @@ void Dfs<N, K>::update_dfs_max_list_size() {
     Logger::warning() << "Memory limit reached: " << get_megabytes(memory_usage);
 #endif
   }
-  memory_usage -= synchrolib::get_memory_usage(list_invbfs);
+  memory_usage -= synchrolib::get_memory_usage(get_dfs_list()) + worker_list_bytes;
 
+  // each worker (thread or process) keeps its own stack of lists
   dfs_max_list_size = static_cast<size_t>((max_memory - memory_usage) /
-      (sizeof(Subset<N>) * (K + 1) * (max_depth - reset_threshold)));
+      (sizeof(Subset<N>) * (K + 1) * (max_depth - reset_threshold) * workers * processes));
 
   if (dfs_max_list_size < DFS_MIN_LIST_SIZE) {
 #if STRICT_MEMORY_LIMIT
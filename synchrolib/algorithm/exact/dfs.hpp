@@ -5,21 +5,30 @@
 #include <synchrolib/algorithm/algorithm.hpp>
 #include <synchrolib/algorithm/exact/utils.hpp>
 #include <synchrolib/algorithm/exact/meet_in_the_middle.hpp>
+#include <synchrolib/algorithm/exact/dfs_protocol.hpp>
 #include <synchrolib/data_structures/automaton.hpp>
+#include <synchrolib/data_structures/pairs_bound.hpp>
 #include <synchrolib/data_structures/preprocessed_transition.hpp>
 #include <synchrolib/utils/vector.hpp>
 #include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/data_structures/subsets_cache.hpp>
+#include <synchrolib/data_structures/subsets_stats.hpp>
 #include <synchrolib/data_structures/subsets_trie.hpp>
 #include <synchrolib/data_structures/subsets_implicit_trie.hpp>
 #include <synchrolib/utils/connectivity.hpp>
 #include <synchrolib/utils/distribution.hpp>
 #include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/interrupt.hpp>
 #include <synchrolib/utils/logger.hpp>
+#include <synchrolib/utils/shared_memory.hpp>
+#include <synchrolib/utils/socket.hpp>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <cstring>
 #include <exception>
 #include <map>
+#include <mutex>
 #include <numeric>
 #include <future>
 #include <optional>
@@ -41,12 +50,26 @@ public:
       std::array<PreprocessedTransition<N, K>, K>& invptrans,
       uint64& reset_threshold,
       FastVector<Subset<N>>& list_bfs,
+      const SubsetsStats<N>& stats_bfs,
+      uint64 bfs_depth,
       FastVector<Subset<N>>& list_invbfs,
+      const SubsetsStats<N>& stats_invbfs,
       uint64 max_depth,
-      size_t max_memory);
+      size_t max_memory,
+      bool forward);
 
   bool run();
 
+  // solves the subproblems leased by a coordinator, see dfs_protocol.hpp
+  static void run_worker(Socket& socket);
+
+  // forward set contained in an inverse set of the last found word (with FIND_WORD)
+  const std::optional<Subset<N>>& get_meeting_set() const { return meeting_set; }
+  // number of forward steps giving the meeting set
+  uint64 get_meeting_depth() const { return meeting_depth; }
+  // a word of length max depth + 1 exists, also after a failed (stopped) run
+  uint64 get_max_depth() const { return max_depth; }
+
 private:
   using Iterator = typename FastVector<Subset<N>>::iterator;
   using ConstIterator = typename FastVector<Subset<N>>::const_iterator;
@@ -58,24 +81,134 @@ private:
   std::array<PreprocessedTransition<N, K>, K>& invptrans;
   uint64& reset_threshold;
   FastVector<Subset<N>>& list_bfs;
+  const SubsetsStats<N>& stats_bfs;  // of list_bfs before the permutation
+  uint64 bfs_depth;                  // number of BFS steps giving list_bfs
   uint64 list_bfs_size;
   cost_t density_bfs;
   FastVector<Subset<N>>& list_invbfs;
+  const SubsetsStats<N>& stats_invbfs;  // of list_invbfs before the permutation
 
-  uint64 max_depth;
-  size_t dfs_max_list_size;
-  SubsetsTrie<N, THREADS> trie_bfs;
+  std::atomic<uint64> max_depth;  // lowered by any worker, read by all
   size_t max_memory;
+  // the forward images are expanded and list_invbfs is indexed, instead of the inverse images and list_bfs
+  bool forward;
+  uint workers;    // threads of the parallel inverse DFS
+  uint processes;  // processes of the inverse DFS
+  std::atomic<size_t> dfs_max_list_size;
+  std::mutex found_mutex;
+  std::atomic<size_t> task_bytes = 0;         // of the queued tasks of process_invdfs_parallel
+  std::atomic<size_t> worker_list_bytes = 0;  // of the lists of its workers
+  SubsetsTrie<N, THREADS> trie_bfs;
+  SubsetsTrie<N, THREADS> trie_invbfs;  // negated, with forward
+  PairsBound<N, K> pairs_bound;
+  SubsetsCache<N> refuted;  // inverse sets without a word within the remaining steps (+ 1)
+  size_t refuted_bytes = 0;  // of refuted in each process, allocated when its search starts
+  FastVector<std::pair<Iterator, Iterator>> bfs_segments;  // of the last bfs_step_dfs, by size
+  std::optional<Subset<N>> meeting_set;
+  uint64 meeting_depth;
+  FastVector<double> state_weights;  // -log of the fraction of trie_bfs sets without the state
+  Clock::time_point dfs_start;
+  uint64 found_count = 0;
+  size_t first_found_ms = 0;
+  size_t last_found_ms = 0;
 
   size_t get_memory_usage() const override;
 
-  FastVector<uint> get_order();
+  FastVector<uint> get_order(const SubsetsStats<N>& stats);
 
   void prepare();
 
+  struct Task {
+    FastVector<Subset<N>> sets;
+    uint64 lsw;
+    uint64 depth;
+  };
+
+  // state shared by the DFS processes
+  struct SharedBound {
+    std::atomic<uint64> max_depth;
+    std::atomic<int64> lock_owner;  // pid holding the lock of the fields below, 0 if none
+    uint64 meeting_lsw;
+    Subset<N> meeting_set;
+  };
+  static constexpr int64 PENDING = 0;  // status of a subproblem, otherwise the pid of its process
+  static constexpr int64 DONE = -1;
+  static constexpr int EXIT_OUT_OF_MEMORY = 2;
+  static constexpr int EXIT_INTERRUPTED = 3;
+  static constexpr size_t SUBPROBLEMS_PER_PROCESS = 16;
+  static constexpr size_t PROBE_WIDTH = 1024;  // sets of a branch of the discrepancy probe
+  static constexpr size_t REFUTED_SETS_PER_FRONTIER_SET = 16;  // entries of refuted
+  static constexpr size_t REFUTED_MEMORY_FRACTION = 8;  // of the memory left, for all processes
+
+  // observed effect of a reduction kind at a depth of the DFS (forward or inverse)
+  struct ReductionHistory {
+    double reduced = 0;  // fraction of the expanded sets removed
+    double ns = 0;       // time per expanded set
+    uint64 samples = 0;
+    uint64 skipped = 0;  // calls since the last measurement
+
+    void update(double new_reduced, double new_ns) {
+      double weight = (samples == 0 ? 1 : HISTORY_WEIGHT);
+      reduced = (1 - weight) * reduced + weight * new_reduced;
+      ns = (1 - weight) * ns + weight * new_ns;
+      samples++;
+      skipped = 0;
+    }
+  };
+  enum class Reduction {
+    SKIP, MEASURE, APPLY  // MEASURE may apply it only to a sample
+  };
+  struct DepthReductions {
+    ReductionHistory duplicates;
+    ReductionHistory subsets;
+  };
+  static constexpr double HISTORY_WEIGHT = 0.25;  // of a new measurement
+  static constexpr uint64 REDUCTION_MIN_SAMPLES = 2;
+  static constexpr uint64 REDUCTION_PROBE_PERIOD = 32;
+  static constexpr size_t REDUCTION_SAMPLE = 4096;
+  static constexpr size_t SUBSETS_REDUCERS = 20000;  // sets reducing their subsets
+
+  std::mutex reduction_mutex;
+  FastVector<DepthReductions> reduction_history;  // by depth, guarded by reduction_mutex
+  double step_ns = 0;                             // time of a step per set without the reductions
+
+  SharedBound* shared_bound = nullptr;  // in a DFS process
+  Socket* coordinator = nullptr;        // in a TCP worker
+
   void process_invdfs(size_t begin, size_t end, const uint64 lsw, const uint64 depth);
-  std::tuple<bool, size_t, size_t> invbfs_step_dfs(size_t begin, size_t end, bool reduce_duplicates, size_t reduce_subsets);
+  void probe_invdfs(size_t begin, size_t end, const uint64 lsw, const uint64 depth, uint64 discrepancies);
+  void order_branches(FastVector<Subset<N>>& list, size_t begin, size_t end) const;
+  void update_state_weights();
+  size_t get_dfs_ms() const;
+  size_t note_found();
+  void process_invdfs_parallel();
+  void process_invdfs_processes();
+  void process_invdfs_coordinator();
+  void send_snapshot(Socket& socket, uint64 bound) const;
+  void run_subproblems(SharedArray<std::atomic<int64>>& status, const FastVector<std::pair<size_t, size_t>>& ranges);
+  void sync_max_depth();
+  void publish_found(uint64 lsw);
+  template <uint Threads>
+  std::tuple<bool, size_t, size_t> invbfs_step_dfs(FastVector<Subset<N>>& list,
+      size_t begin, size_t end, const uint64 lsw, const uint64 depth);
+
+  Reduction should_reduce(ReductionHistory& history, uint64 remaining) const;
+
+  void process_dfs(size_t begin, size_t end, const uint64 lsw, const uint64 depth);
+  std::tuple<bool, size_t, size_t> bfs_step_dfs(size_t begin, size_t end, const uint64 lsw, const uint64 depth);
+
+  template <uint Threads>
+  bool segments_contain_subset(const SubsetsTrie<N, THREADS>& trie,
+      const FastVector<std::pair<Iterator, Iterator>>& segments, uint min_size, size_t count) const;
 
+  void build_trie_bfs(FastVector<Subset<N>> list);
+  void remove_distant_bfs();
+  void plan_refuted();
+  void allocate_refuted();
+  void remember_refuted(size_t begin, size_t end, uint64 lsw);
+  void save_meeting_set(FastVector<Subset<N>>& list, size_t begin, size_t end);
+  void save_forward_meeting_set(size_t begin, size_t end, uint64 bfs_steps);
+  FastVector<Subset<N>>& get_dfs_list() { return forward ? list_bfs : list_invbfs; }
   void update_dfs_max_list_size();
   
   cost_t get_trie_evn(const cost_t m, const cost_t p, const cost_t q);
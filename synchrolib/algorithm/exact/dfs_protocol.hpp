@@ -0,0 +1,47 @@
+#pragma once
+#include <synchrolib/utils/general.hpp>
+#include <exception>
+
+namespace synchrolib {
+
+// Messages between the DFS coordinator (Exact with dfs_coordinator_port) and the
+// workers (synchro --worker), each is a type followed by its fields.
+//
+// coordinator -> worker:
+//   JOB       uint n, uint k (the worker loads the library for its config and n, k)
+//   SNAPSHOT  string automaton, uint64 reset_threshold, uint64 max_depth, uint64 bfs_depth,
+//             uint64 max_memory, trie_bfs sets, the inverse frontier (the automaton and
+//             the sets are permuted)
+//   LEASE     uint64 subproblem, uint64 begin, uint64 end (a range of the frontier)
+//   BOUND     uint64 max_depth (sent to all the workers when a shorter word is found)
+//   FINISHED  (the search is over, also sent to the workers still searching)
+//
+// worker -> coordinator:
+//   READY          (the library is loaded)
+//   REQUEST        (the worker is idle, answered with LEASE or FINISHED)
+//   DONE           uint64 subproblem
+//   FOUND          uint64 lsw, bool has_meeting_set, Subset<N> meeting_set
+//   OUT_OF_MEMORY
+//
+// A message that breaks the protocol (a wrong type, an index or a size out of range)
+// throws SocketException, the coordinator drops the worker and the worker exits. The
+// coordinator also drops a worker stalling a message for its PEER_TIMEOUT.
+enum class DfsMessage : uint32l {
+  JOB,
+  SNAPSHOT,
+  LEASE,
+  BOUND,
+  FINISHED,
+  READY,
+  REQUEST,
+  DONE,
+  FOUND,
+  OUT_OF_MEMORY
+};
+
+// thrown in a worker searching a subproblem when FINISHED arrives
+class DfsFinishedException : public std::exception {
+  const char* what() const throw() { return "DfsFinishedException"; }
+};
+
+}  // namespace synchrolib
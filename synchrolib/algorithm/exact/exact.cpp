@@ -8,6 +8,7 @@
 #include <synchrolib/algorithm/exact/utils.hpp>
 #include <synchrolib/algorithm/exact/meet_in_the_middle.hpp>
 #include <synchrolib/algorithm/exact/dfs.hpp>
+#include <synchrolib/algorithm/exact/word_reconstruction.hpp>
 #include <synchrolib/data_structures/automaton.hpp>
 #include <synchrolib/data_structures/preprocessed_transition.hpp>
 #include <synchrolib/data_structures/subset.hpp>
@@ -17,6 +18,7 @@
 #include <synchrolib/utils/connectivity.hpp>
 #include <synchrolib/utils/distribution.hpp>
 #include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/interrupt.hpp>
 #include <synchrolib/utils/logger.hpp>
 #include <cassert>
 #include <cmath>
@@ -52,7 +54,14 @@ void Exact<N, K>::run(AlgoData<N, K>& data) {
     return;
   }
 
+  InterruptScope interrupt_scope(MAX_TIME_S);
+  if (InterruptScope::signaled()) {
+    Logger::warning() << "Interrupted before the start";
+    return;
+  }
+
   reset_threshold = 0;
+  dfs_upper_bound = data.result.mlsw_upper_bound;
 
   calculate_max_memory();
 
@@ -62,23 +71,56 @@ void Exact<N, K>::run(AlgoData<N, K>& data) {
 
   preprocess_transitions();
 
-  bool found = run_meet_in_the_middle(data.result.mlsw_upper_bound - 1);
+  // a word of the length of the upper bound has to be found too, if it's not known
+  uint64 max_reset_threshold = data.result.mlsw_upper_bound - 1;
+#if FIND_WORD
+  bool reduced = data.result.reduce && data.result.reduce->done;
+  if (!reduced && (!data.result.word || data.result.word->size() != data.result.mlsw_upper_bound)) {
+    max_reset_threshold = data.result.mlsw_upper_bound;
+  }
+#endif
+  meeting_set = std::nullopt;
+
+  bool found = run_meet_in_the_middle(max_reset_threshold);
 
 #if DFS
-  if (!found) {
-    if (run_dfs(data.result.mlsw_upper_bound - 1)) {
+  if (!found && !InterruptScope::requested()) {
+    if (run_dfs(max_reset_threshold)) {
       reset_threshold++;
       found = true;
     }
   }
 #endif
 
+  // after a stop (or the memory limit) only lengths up to reset_threshold are excluded,
+  // the words found by a stopped DFS still lower the upper bound
   if (!found) {
     reset_threshold++;
+    uint64 upper_bound = std::min(data.result.mlsw_upper_bound, dfs_upper_bound);
+#if FIND_WORD
+    // such a word is not reconstructed, so a kept word keeps its bound
+    if (data.result.word && upper_bound < data.result.mlsw_upper_bound) {
+      Logger::warning() << "The word of length " << upper_bound << " found by DFS is not reconstructed";
+      upper_bound = data.result.mlsw_upper_bound;
+    }
+#endif
+    data.result.mlsw_upper_bound = upper_bound;
     if (reset_threshold == data.result.mlsw_upper_bound) {
       found = true;
     }
   }
+  if (!found && InterruptScope::requested()) {
+    Logger::warning() << "Interrupted, mlsw in [" << reset_threshold << ", "
+                      << data.result.mlsw_upper_bound << "]";
+  }
+
+#if FIND_WORD
+  if (found && InterruptScope::requested()) {
+    Logger::warning() << "Interrupted, the synchronizing word is not reconstructed";
+  } else if (found) {
+    find_word(data);
+  }
+#endif
 
   if (data.result.reduce && data.result.reduce->done) {
     reset_threshold += data.result.reduce->bfs_steps;
@@ -195,13 +237,75 @@ void Exact<N, K>::preprocess_transitions() {
 template<uint N, uint K>
 bool Exact<N, K>::run_meet_in_the_middle(uint64 max_reset_threshold) {
   MeetInTheMiddle<N, K> mitm(aut, invaut, ptrans, invptrans, reset_threshold, list_bfs, list_invbfs, max_reset_threshold, max_memory);
-  return mitm.run();
+  bool found = mitm.run();
+  meeting_depth = mitm.get_bfs_steps();
+  meeting_set = mitm.get_meeting_set();
+  stats_bfs = mitm.get_stats_bfs();
+  stats_invbfs = mitm.get_stats_invbfs();
+  dfs_forward = mitm.get_dfs_forward();
+  return found;
 }
 
 template<uint N, uint K>
 bool Exact<N, K>::run_dfs(uint64 max_reset_threshold) {
-  Dfs<N, K> dfs(aut, invaut, ptrans, invptrans, reset_threshold, list_bfs, list_invbfs, max_reset_threshold, max_memory);
-  return dfs.run();
+  Dfs<N, K> dfs(aut, invaut, ptrans, invptrans, reset_threshold, list_bfs, stats_bfs, meeting_depth, list_invbfs, stats_invbfs, max_reset_threshold, max_memory, dfs_forward);
+  bool found = dfs.run();
+  dfs_upper_bound = std::min(dfs_upper_bound, dfs.get_max_depth() + 1);
+  meeting_set = dfs.get_meeting_set();
+  meeting_depth = dfs.get_meeting_depth();
+  return found;
+}
+
+template<uint N, uint K>
+void Exact<N, K>::find_word(AlgoData<N, K>& data) {
+  if (data.result.word && data.result.word->size() == reset_threshold) {
+    return;
+  }
+  if (data.result.reduce && data.result.reduce->done) {
+    Logger::warning() << "Cannot find synchronizing word (not just length) after reduction";
+    return;
+  }
+
+  list_bfs = list_invbfs = FastVector<Subset<N>>();
+  FastVector<Subset<N>> targets;
+  for (uint n = 0; n < N; n++) {
+    targets.push_back(Subset<N>::Singleton(n));
+  }
+
+  // with a meeting set, the word is split into the BFS and the inverse part
+  std::optional<FastVector<uint>> word;
+  try {
+    WordReconstruction<N, K> reconstruction(ptrans, invptrans, max_memory);
+    if (meeting_set && meeting_depth <= reset_threshold) {
+      word = reconstruction.run(Subset<N>::Complete(), FastVector<Subset<N>>{*meeting_set}, meeting_depth);
+      auto suffix = reconstruction.run(*meeting_set, targets, reset_threshold - meeting_depth);
+      if (word && suffix) {
+        word->insert(word->end(), suffix->begin(), suffix->end());
+      } else {
+        word = std::nullopt;
+      }
+    } else {
+      word = reconstruction.run(Subset<N>::Complete(), targets, reset_threshold);
+    }
+  } catch (OutOfMemoryException& ex) {
+    Logger::warning() << "Ended by exceeding the memory limit while finding synchronizing word";
+    return;
+  }
+
+  // the letters do not depend on the order of states, so the word is checked on the input automaton
+  auto sub = Subset<N>::Complete();
+  if (word) {
+    for (auto k : *word) {
+      Subset<N> next;
+      sub.apply(data.aut, k, next);
+      sub = next;
+    }
+  }
+  if (!word || word->size() != reset_threshold || sub.size() != 1) {
+    Logger::error() << "Failed to find synchronizing word of length " << reset_threshold;
+    return;
+  }
+  data.result.word = std::move(*word);
 }
 
 template class Exact<AUT_N, AUT_K>;
@@ -6,15 +6,18 @@
 #include <synchrolib/algorithm/exact/utils.hpp>
 #include <synchrolib/algorithm/exact/meet_in_the_middle.hpp>
 #include <synchrolib/algorithm/exact/dfs.hpp>
+#include <synchrolib/algorithm/exact/word_reconstruction.hpp>
 #include <synchrolib/data_structures/automaton.hpp>
 #include <synchrolib/data_structures/preprocessed_transition.hpp>
 #include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/data_structures/subsets_stats.hpp>
 #include <synchrolib/utils/vector.hpp>
 #include <synchrolib/data_structures/subsets_trie.hpp>
 #include <synchrolib/data_structures/subsets_implicit_trie.hpp>
 #include <synchrolib/utils/connectivity.hpp>
 #include <synchrolib/utils/distribution.hpp>
 #include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/interrupt.hpp>
 #include <synchrolib/utils/logger.hpp>
 #include <cassert>
 #include <cmath>
@@ -48,6 +51,13 @@ private:
 
   FastVector<Subset<N>> list_bfs;
   FastVector<Subset<N>> list_invbfs;
+  SubsetsStats<N> stats_bfs;     // of list_bfs after the meet in the middle
+  SubsetsStats<N> stats_invbfs;  // of list_invbfs after the meet in the middle
+
+  bool dfs_forward;                      // DFS over the forward images predicted cheaper
+  uint64 meeting_depth;                  // number of BFS steps, the depth of meeting_set
+  std::optional<Subset<N>> meeting_set;  // set in the middle of a shortest word (with FIND_WORD)
+  uint64 dfs_upper_bound;                // a word of this length was found by DFS, even if it did not finish
 
   static constexpr size_t MEMORY_RESERVE =
       1024 * 1024 * 16;                        // 16mb reserved for misc objects
@@ -63,6 +73,7 @@ private:
 
   bool run_meet_in_the_middle(uint64 max_reset_threshold);
   bool run_dfs(uint64 max_reset_threshold);
+  void find_word(AlgoData<N, K>& data);
 };
 
 }  // namespace synchrolib
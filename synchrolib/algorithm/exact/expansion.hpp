@@ -0,0 +1,101 @@
+#pragma once
+#include <jitdefines.hpp>
+
+#include <synchrolib/algorithm/exact/utils.hpp>
+#include <synchrolib/data_structures/preprocessed_transition.hpp>
+#include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/data_structures/subsets_stats.hpp>
+#include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/timer.hpp>
+#include <synchrolib/utils/vector.hpp>
+#include <algorithm>
+#include <array>
+
+#ifndef __INTELLISENSE__
+$EXACT_DEF$
+#endif
+
+namespace synchrolib {
+
+constexpr size_t EXPANSION_BUFFER_SIZE = 1024 * 1024 * 8;  // 8mb buffer for the chunked expansion
+constexpr size_t EXPANSION_CHUNK_FRACTION = 8;  // of the expanded list, the limit of a larger chunk
+
+// Applies all letters to the list chunk by chunk, each chunk is sorted and
+// deduplicated in the buffer and merged into the result, so the result never
+// holds duplicates. The chunks grow with the result (up to 1 / EXPANSION_CHUNK_FRACTION
+// of it), which keeps the merges linear in the number of images. The result is
+// reserved for the expected size (K * list.size() less the expected fraction of
+// duplicates) and fits(capacity, buffer_size) (in sets) is checked before the
+// result or the buffer grow. The statistics, if given, are counted per chunk while
+// it is in the buffer, without the duplicates found by the merge.
+// Neither the list nor stats is modified if OutOfMemoryException is thrown.
+template <uint N, uint K, class Fits>
+FastVector<Subset<N>> expand_keep_unique(
+    const std::array<PreprocessedTransition<N, K>, K>& trans, const FastVector<Subset<N>>& list,
+    double reduced_duplicates, Fits fits, SubsetsStats<N>* stats = nullptr) {
+  Timer expand_timer("expand");
+  FastVector<Subset<N>> list_next;
+  FastVector<Subset<N>> buffer;
+  SubsetsStats<N> stats_next;
+
+  const size_t min_chunk = std::min(list.size(),
+      std::max(static_cast<size_t>(1), EXPANSION_BUFFER_SIZE / (K * sizeof(Subset<N>))));
+  const size_t expected = std::min(K * list.size(),
+      static_cast<size_t>(K * (1.0 - reduced_duplicates) * list.size()));
+  if (!fits(expected, K * min_chunk)) {
+    throw OutOfMemoryException();
+  }
+  list_next.reserve(expected);
+  buffer.resize(K * min_chunk);
+
+  for (size_t pos = 0; pos < list.size();) {
+    size_t chunk = std::max(min_chunk, list_next.size() / (K * EXPANSION_CHUNK_FRACTION));
+    if (K * chunk > buffer.size()) {
+      if (fits(list_next.capacity(), K * chunk)) {
+        buffer.resize(K * chunk);
+      }
+      chunk = buffer.size() / K;
+    }
+    const size_t count = std::min(chunk, list.size() - pos);
+    for (uint k = 0; k < K; ++k) {
+      trans[k].apply(list.data() + pos, buffer.data() + k * count, count);
+    }
+    pos += count;
+
+    auto end = buffer.begin() + K * count;
+    std::sort(buffer.begin(), end);
+    end = std::unique(buffer.begin(), end);
+    if (stats) {
+      stats_next.add(buffer.begin(), end);
+    }
+
+    const size_t capacity = list_next.size() + std::distance(buffer.begin(), end);
+    if (capacity > list_next.capacity()) {
+      size_t grown = std::max(capacity, list_next.capacity() + list_next.capacity() / 4);
+      if (!fits(grown, buffer.size())) {
+        grown = capacity;
+      }
+      if (!fits(grown, buffer.size())) {
+        throw OutOfMemoryException();
+      }
+      list_next.reserve(grown);
+    }
+    merge_keep_unique(list_next, buffer.data(), buffer.data() + std::distance(buffer.begin(), end),
+        [stats, &stats_next](const Subset<N>& sub) {
+          if (stats) {
+            stats_next.remove(sub);
+          }
+        });
+  }
+
+  if (stats) {
+    *stats = stats_next;
+  }
+  return list_next;
+}
+
+}  // namespace synchrolib
+
+#ifndef __INTELLISENSE__
+$EXACT_UNDEF$
+#endif
@@ -5,19 +5,27 @@
 
 #include <algorithm>
 #include <synchrolib/algorithm/algorithm.hpp>
+#include <synchrolib/algorithm/exact/cost_model.hpp>
+#include <synchrolib/algorithm/exact/expansion.hpp>
 #include <synchrolib/algorithm/exact/utils.hpp>
 #include <synchrolib/data_structures/automaton.hpp>
+#include <synchrolib/data_structures/pairs_bound.hpp>
 #include <synchrolib/data_structures/preprocessed_transition.hpp>
 #include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/data_structures/subset_utils.hpp>
+#include <synchrolib/data_structures/subsets_check_strategy.hpp>
 #include <synchrolib/data_structures/subsets_trie.hpp>
 #include <synchrolib/utils/vector.hpp>
 #include <synchrolib/data_structures/subsets_implicit_trie.hpp>
+#include <synchrolib/data_structures/subsets_scan.hpp>
 #include <synchrolib/utils/connectivity.hpp>
 #include <synchrolib/utils/distribution.hpp>
 #include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/interrupt.hpp>
 #include <synchrolib/utils/logger.hpp>
 #include <synchrolib/utils/timer.hpp>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstring>
 #include <exception>
@@ -61,6 +69,8 @@ bool MeetInTheMiddle<N, K>::run() {
   last_reduction_bfs_visited_size = last_reduction_invbfs_visited_size = 0;
   last_bfs_list_size = last_invbfs_list_size = 0;
   steps_bfs = steps_invbfs = 0;
+  list_bfs_sorted = list_invbfs_sorted = trie_bfs_built = false;
+  bfs_cost_correction = invbfs_cost_correction = 1;
 
   // TODO: test
   // list_bfs_visited = list_bfs;
@@ -69,28 +79,45 @@ bool MeetInTheMiddle<N, K>::run() {
   //   sub.negate();
   // }
 
+  for (auto& sub : list_invbfs) {
+    sub.negate();
+  }
+  stats_bfs = SubsetsStats<N>(list_bfs.begin(), list_bfs.end());
+  stats_invbfs = SubsetsStats<N>(list_invbfs.begin(), list_invbfs.end());
+  stats_bfs_visited = stats_invbfs_visited = SubsetsStats<N>();
+  pairs_bound.initialize(aut);
+
   bool found = false;
   while (reset_threshold < max_reset_threshold) {
     if (get_memory_usage() > max_memory) {
       Logger::warning() << "Ended by exceeding the memory limit";
       break;
     }
+    if (InterruptScope::requested()) {
+      Logger::warning() << "Interrupted at depth " << reset_threshold;
+      break;
+    }
 
     calculate_decision();
-    if (decision.phase == Decision::Phase::IDFS) {
+    if (decision.phase == Decision::Phase::FDFS || decision.phase == Decision::Phase::IDFS) {
       break;
     }
 
     reset_threshold++;
     try {
+      Timer step_timer("step");
       if (decision.phase == Decision::Phase::BFS) process_bfs_step();
       else process_invbfs_step();
 
       Timer goal_check("goal_check");
-      auto it = SubsetsImplicitTrie<N, false, THREADS>::check_contains_subset(list_bfs, list_invbfs);
+      bool met = check_goal();
       goal_check.stop();
+      update_cost_correction(step_timer.template stop<false, std::chrono::nanoseconds>());
 
-      if (it != list_invbfs.end()) {
+      if (met) {
+#if FIND_WORD
+        save_meeting_set();
+#endif
         Logger::verbose() << "Synchronizing word found at depth " << reset_threshold;
         found = true;
         break;
@@ -103,15 +130,97 @@ bool MeetInTheMiddle<N, K>::run() {
   }
 
   list_bfs_visited = list_invbfs_visited = FastVector<Subset<N>>(); // TODO: uwr vector UB
+  stats_bfs_visited = stats_invbfs_visited = SubsetsStats<N>();
+  trie_bfs.reset();
+  for (auto& sub : list_invbfs) {
+    sub.negate();
+  }
+  stats_invbfs = stats_invbfs.negated();
   return found;
 }
 
+// A meeting is a list_bfs set disjoint with a (negated) list_invbfs set. The check
+// is symmetric, so either list can be indexed, and the index type is chosen from
+// the list statistics (a short list is scanned). The sorted lists and trie_bfs are
+// reused while the list is unchanged, e.g. list_bfs during a series of IBFS steps.
+// Only the existence of a meeting is needed, so the search stops at the first one.
+template<uint N, uint K>
+bool MeetInTheMiddle<N, K>::check_goal() {
+  using Strategy = SubsetsCheckStrategy<N, THREADS>;
+  typename Strategy::ListState bfs_state, invbfs_state;
+  bfs_state.sorted = list_bfs_sorted;
+  bfs_state.trie_built = trie_bfs_built;
+  bfs_state.trie_fits = (get_memory_usage() + 2 * synchrolib::get_memory_usage(list_bfs) <= max_memory);
+  invbfs_state.sorted = list_invbfs_sorted;
+  invbfs_state.trie_fits = (get_memory_usage() + 2 * synchrolib::get_memory_usage(list_invbfs) <= max_memory);
+
+  auto strategy = Strategy::template choose<true>(stats_bfs, stats_invbfs, bfs_state, invbfs_state);
+  Logger::debug() << "Goal check | " << (strategy.swapped ? "list_invbfs" : "list_bfs") << " indexed, " << strategy.describe();
+
+  auto& indexed = (strategy.swapped ? list_invbfs : list_bfs);
+  auto& query = (strategy.swapped ? list_bfs : list_invbfs);
+  switch (strategy.index) {
+    case Strategy::Index::IMPLICIT_TRIE: {
+      bool& sorted = (strategy.swapped ? list_invbfs_sorted : list_bfs_sorted);
+      if (!sorted) {
+        Timer index_timer("goal index");
+        std::sort(indexed.begin(), indexed.end());
+        sorted = true;
+      }
+      return SubsetsImplicitTrie<N, false, THREADS, true, false, true>::any_contains_subset(indexed, query);
+    }
+
+    case Strategy::Index::TRIE: {
+      SubsetsTrie<N, THREADS> trie_invbfs;
+      if (!strategy.swapped && !trie_bfs_built) {
+        trie_bfs.build(list_bfs);
+        trie_bfs_built = true;
+      } else if (strategy.swapped) {
+        trie_invbfs.build(list_invbfs);
+      }
+      const auto& trie = (strategy.swapped ? trie_invbfs : trie_bfs);
+
+      Timer check_timer("goal trie check");
+      return std::any_of(query.begin(), query.end(), [&trie](const Subset<N>& sub) {
+        auto complement = sub;
+        complement.negate();
+        return trie.contains_subset_of(&complement, &complement + 1);
+      });
+    }
+
+    case Strategy::Index::SCAN: {
+      Timer check_timer("goal scan");
+      SubsetsScan<N> scan(indexed.begin(), indexed.end());
+      return std::any_of(query.begin(), query.end(), [&scan](const Subset<N>& sub) {
+        return scan.contains_disjoint_with(sub);
+      });
+    }
+  }
+  throw std::runtime_error("Impossible");
+}
+
+template<uint N, uint K>
+void MeetInTheMiddle<N, K>::save_meeting_set() {
+  if (!list_bfs_sorted) {
+    std::sort(list_bfs.begin(), list_bfs.end());
+    list_bfs_sorted = true;
+  }
+  auto it = SubsetsImplicitTrie<N, false, THREADS, true, false, true>::check_contains_subset(list_bfs, list_invbfs);
+  for (const auto& sub : list_bfs) {
+    if (it != list_invbfs.end() && sub.is_disjoint(*it)) {
+      meeting_set = sub;
+      return;
+    }
+  }
+}
+
 template<uint N, uint K>
 size_t MeetInTheMiddle<N, K>::get_memory_usage() const {
   return synchrolib::get_memory_usage(list_bfs) +
       synchrolib::get_memory_usage(list_invbfs) +
       synchrolib::get_memory_usage(list_bfs_visited) +
       synchrolib::get_memory_usage(list_invbfs_visited) +
+      synchrolib::get_memory_usage(trie_bfs) +
       synchrolib::get_memory_usage(ptrans) +
       synchrolib::get_memory_usage(invptrans);
 }
@@ -133,22 +242,25 @@ void MeetInTheMiddle<N, K>::process_bfs_step() {
     Logger::verbose() << "(BFS) reducing visited list";
 
     {
-      uint max_size_visited = 0;
-      for (const auto& x : list_bfs_visited) { if (x.size() > max_size_visited) max_size_visited = x.size(); }
-
-      uint max_size = 0;
-      for (const auto& x : list_bfs) { if (x.size() > max_size) max_size = x.size(); }
-      auto visited_end = std::remove_if(list_bfs_visited.begin(), list_bfs_visited.end(), [&](const Subset<N> &s){return s.size() > max_size;});
+      uint max_size_visited = stats_bfs_visited.max_size();
+      uint max_size = stats_bfs.max_size();
+      auto visited_end = std::remove_if(list_bfs_visited.begin(), list_bfs_visited.end(), [&](const Subset<N> &s){
+        if (s.size() <= max_size) return false;
+        stats_bfs_visited.remove(s); // the removed elements are not left at the end
+        return true;
+      });
       Logger::debug() << "max_size_visited " << max_size_visited << " max_size " << max_size << " removed " << (list_bfs_visited.end() - visited_end);
     
       list_bfs_visited.erase(visited_end, list_bfs_visited.end());
     }
 
-    SubsetsImplicitTrie<N, true, THREADS>::reduce(list_bfs_visited); // memory checked in calculate_decision()
+    SubsetsImplicitTrie<N, true, THREADS>::reduce(list_bfs_visited, &stats_bfs_visited); // memory checked in calculate_decision()
     last_reduction_bfs_visited_size = list_bfs_visited.size();
   }
 
   last_bfs_list_size = list_bfs.size();
+  list_bfs_sorted = trie_bfs_built = false;
+  trie_bfs.reset();
   bfs_step(aut, invaut);
 }
 
@@ -167,53 +279,67 @@ void MeetInTheMiddle<N, K>::process_invbfs_step() {
 
   if (reduce_visited) {
     Logger::verbose() << "(IBFS) reducing visited list";
-    SubsetsImplicitTrie<N, true, THREADS>::reduce(list_invbfs_visited); // memory checked in calculate_decision()
+    SubsetsImplicitTrie<N, true, THREADS>::reduce(list_invbfs_visited, &stats_invbfs_visited); // memory checked in calculate_decision()
     last_reduction_invbfs_visited_size = list_invbfs_visited.size();
   }
 
   last_invbfs_list_size = list_invbfs.size();
+  list_invbfs_sorted = false;
   invbfs_step(aut, invaut);
+  list_invbfs_sorted = true;  // both variants of the step leave it sorted
+}
+
+// the expanded list and twice its chunk (the buffer and the merged part of the result)
+template<uint N, uint K>
+size_t MeetInTheMiddle<N, K>::get_expansion_memory(size_t list_size, double reduced_duplicates) const {
+  const size_t expanded = sizeof(Subset<N>) * static_cast<size_t>(K * (1.0 - reduced_duplicates) * list_size);
+  return expanded + 2 * std::max(EXPANSION_BUFFER_SIZE, expanded / EXPANSION_CHUNK_FRACTION);
+}
+
+template<uint N, uint K>
+size_t MeetInTheMiddle<N, K>::get_reduced_expansion_memory(size_t list_size, double reduced_duplicates) const {
+  return get_expansion_memory(list_size, reduced_duplicates) +
+      SubsetsImplicitTrie<N, true>::get_reduce_memory(static_cast<size_t>(K * (1.0 - reduced_duplicates) * list_size));
+}
+
+// see expand_keep_unique(), the result and the buffer are checked against max_memory
+template<uint N, uint K>
+FastVector<Subset<N>> MeetInTheMiddle<N, K>::expand(
+    const std::array<PreprocessedTransition<N, K>, K>& trans,
+    const FastVector<Subset<N>>& list, SubsetsStats<N>& stats, double reduced_duplicates) const {
+  auto fits = [this](size_t capacity, size_t buffer_size) {
+    return get_memory_usage() + sizeof(Subset<N>) * (capacity + buffer_size) <= max_memory;
+  };
+  return expand_keep_unique<N, K>(trans, list, reduced_duplicates, fits, &stats);
 }
 
 template<uint N, uint K>
 void MeetInTheMiddle<N, K>::bfs_step(
     const Automaton<N, K>& aut, const InverseAutomaton<N, K>& invaut) {
-  const size_t next_size = list_bfs.size() * K;
-  if (get_memory_usage() + sizeof(Subset<N>) * next_size > max_memory || out_of_memory_dfs(list_bfs.size())) {
+  if (out_of_memory_dfs(list_bfs.size())) {
     throw OutOfMemoryException();
   }
 
-  FastVector<Subset<N>> list_next(next_size);
-  Timer apply_timer("apply");
-  for (uint k = 0; k < K; ++k) {
-    ptrans[k].apply(list_bfs.data(), list_next.data() + (k * list_bfs.size()), list_bfs.size());
-  }
-  apply_timer.stop();
-
-  list_bfs = std::move(list_next);
+  ReductionCalculator reduced_duplicates(K * list_bfs.size());
+  list_bfs = expand(ptrans, list_bfs, stats_bfs, bfs_reduction_history.reduced_duplicates);
+  bfs_reduction_history.reduced_duplicates = reduced_duplicates.calculate(list_bfs.size());
+  remove_distant_bfs();
 
   if (decision.bfs_novisited) {
-    ReductionCalculator reduced_duplicates(list_bfs.size());
-    sort_keep_unique(list_bfs);
-    bfs_reduction_history.reduced_duplicates = reduced_duplicates.calculate(list_bfs.size());
-
-    if (get_memory_usage() + synchrolib::get_memory_usage(list_bfs) > max_memory) {
+    if (get_memory_usage() + SubsetsImplicitTrie<N, true>::get_reduce_memory(list_bfs.size()) > max_memory) {
       throw OutOfMemoryException();
     }
     ReductionCalculator reduced_visited(list_bfs.size()); // TODO: it should be reduced_self, but it needs to
                                                           //       be compatible with the equations in calculate_decision()
-    SubsetsImplicitTrie<N, true, THREADS, true>::reduce(list_bfs);
+    SubsetsImplicitTrie<N, true, THREADS, true>::reduce(list_bfs, &stats_bfs);
     bfs_reduction_history.reduced_visited = reduced_visited.calculate(list_bfs.size());
   } else {
     if (get_memory_usage() + synchrolib::get_memory_usage(list_bfs) > max_memory) { // place for visited
       throw OutOfMemoryException();
     }
 
-    sort_keep_unique(list_bfs_visited); // TODO: maybe we don't need to sort here
-
-    ReductionCalculator reduced_duplicates(list_bfs.size());
-    sort_keep_unique(list_bfs);
-    bfs_reduction_history.reduced_duplicates = reduced_duplicates.calculate(list_bfs.size());
+    std::sort(list_bfs_visited.begin(), list_bfs_visited.end()); // TODO: maybe we don't need to sort here
+    keep_unique(list_bfs_visited, [this](const Subset<N>& sub) { stats_bfs_visited.remove(sub); });
 
     list_bfs_visited.reserve(list_bfs_visited.size() + list_bfs.size()); // important!
                                                                          // (we don't want reallocation
@@ -226,13 +352,16 @@ void MeetInTheMiddle<N, K>::bfs_step(
       }
       if (it == end || *it != sub) {
         list_bfs_visited.push_back(sub); // no realloc
+      } else {
+        stats_bfs.remove(sub);
       }
     }
     list_bfs = FastVector<Subset<N>>(end, list_bfs_visited.end());
+    stats_bfs_visited += stats_bfs;
     std::sort(list_bfs_visited.begin(), list_bfs_visited.end()); // must be sorted and not contain duplicates
 
     ReductionCalculator reduced_visited(list_bfs.size());
-    SubsetsImplicitTrie<N, true, THREADS, true>::reduce(list_bfs_visited, list_bfs);
+    SubsetsImplicitTrie<N, true, THREADS, true>::reduce(list_bfs_visited, list_bfs, &stats_bfs);
     bfs_reduction_history.reduced_visited = reduced_visited.calculate(list_bfs.size());
   }
 
@@ -241,80 +370,65 @@ void MeetInTheMiddle<N, K>::bfs_step(
     << " visited + self: " << bfs_reduction_history.reduced_visited;
 }
 
+// A word through a list_bfs set merges all its pairs in the remaining steps,
+// so the sets with a more distant pair cannot meet the inverse list within
+// max_reset_threshold. Dropping them keeps the list sorted and unique.
+template<uint N, uint K>
+void MeetInTheMiddle<N, K>::remove_distant_bfs() {
+  pairs_bound.set_budget(max_reset_threshold - steps_bfs);
+  if (!pairs_bound.prunes()) {
+    return;
+  }
+
+  Timer timer("pairs bound");
+  auto end = std::remove_if(list_bfs.begin(), list_bfs.end(), [this](const Subset<N>& sub) {
+    if (!pairs_bound.exceeds(sub)) return false;
+    stats_bfs.remove(sub);
+    return true;
+  });
+  Logger::debug() << "BFS pairs bound | remaining steps: " << (max_reset_threshold - steps_bfs)
+    << " removed: " << (list_bfs.end() - end);
+  list_bfs.erase(end, list_bfs.end());
+}
+
 template<uint N, uint K>
 void MeetInTheMiddle<N, K>::invbfs_step(
     const Automaton<N, K>& aut, const InverseAutomaton<N, K>& invaut) {
-  const size_t next_size = list_invbfs.size() * K;
-  if (get_memory_usage() + sizeof(Subset<N>) * next_size > max_memory || out_of_memory_dfs(list_invbfs.size())) {
+  if (out_of_memory_dfs(list_invbfs.size())) {
     throw OutOfMemoryException();
   }
 
-  FastVector<Subset<N>> list_next(next_size);
-  for (uint k = 0; k < K; ++k) {
-    invptrans[k].apply(list_invbfs.data(), list_next.data() + (k * list_invbfs.size()), list_invbfs.size());
-  }
-  // for (uint i = 0; i < list_invbfs.size(); i++) {
-  //   for (uint k = 0; k < K; k++) {
-  //     invptrans[k].apply(list_invbfs[i], list_next[i * K + k]);
-  //     // list_invbfs[i].template invapply<N, K>(invaut, k, list_next[i * K + k]);
-  //   }
-  // }
-
-  list_invbfs = std::move(list_next);
+  ReductionCalculator reduced_duplicates(K * list_invbfs.size());
+  list_invbfs = expand(invptrans, list_invbfs, stats_invbfs, invbfs_reduction_history.reduced_duplicates);
+  invbfs_reduction_history.reduced_duplicates = reduced_duplicates.calculate(list_invbfs.size());
 
   if (decision.invbfs_novisited) {
     invbfs_reduction_history.reduced_visited = 0;
 
-    for (auto& sub : list_invbfs) {
-      sub.negate();
-    }
-
-    ReductionCalculator reduced_duplicates(list_invbfs.size());
-    sort_keep_unique(list_invbfs);
-    invbfs_reduction_history.reduced_duplicates = reduced_duplicates.calculate(list_invbfs.size());
-
     ReductionCalculator reduced_self(list_invbfs.size());
-    if (get_memory_usage() + synchrolib::get_memory_usage(list_invbfs) > max_memory) {
-      for (auto& sub : list_invbfs) {
-        sub.negate();
-      }
+    if (get_memory_usage() + SubsetsImplicitTrie<N, true>::get_reduce_memory(list_invbfs.size()) > max_memory) {
       throw OutOfMemoryException();
     }
-    SubsetsImplicitTrie<N, true, THREADS, true, true>::reduce(list_invbfs);
+    SubsetsImplicitTrie<N, true, THREADS, true>::reduce(list_invbfs, &stats_invbfs);
     invbfs_reduction_history.reduced_self = reduced_self.calculate(list_invbfs.size());
-
-    for (auto& sub : list_invbfs) {
-      sub.negate();
-    }
   } else {
     if (get_memory_usage() + sizeof(Subset<N>) * list_invbfs.size() > max_memory) {
       throw OutOfMemoryException();
     }
 
-    for (auto& sub : list_invbfs) {
-      sub.negate();
-    }
-
-    sort_keep_unique(list_invbfs_visited);
-
-    ReductionCalculator reduced_duplicates(list_invbfs.size());
-    sort_keep_unique(list_invbfs);
-    invbfs_reduction_history.reduced_duplicates = reduced_duplicates.calculate(list_invbfs.size());
+    std::sort(list_invbfs_visited.begin(), list_invbfs_visited.end());
+    keep_unique(list_invbfs_visited, [this](const Subset<N>& sub) { stats_invbfs_visited.remove(sub); });
 
     ReductionCalculator reduced_self(list_invbfs.size()); // added
-    if (get_memory_usage() + synchrolib::get_memory_usage(list_invbfs) > max_memory) {
-      for (auto& sub : list_invbfs) {
-        sub.negate();
-      }
+    if (get_memory_usage() + SubsetsImplicitTrie<N, true>::get_reduce_memory(list_invbfs.size()) > max_memory) {
       throw OutOfMemoryException();
     }
-    SubsetsImplicitTrie<N, true, THREADS, true, true>::reduce(list_invbfs);
+    SubsetsImplicitTrie<N, true, THREADS, true>::reduce(list_invbfs, &stats_invbfs); // keeps the list sorted
     invbfs_reduction_history.reduced_self = reduced_self.calculate(list_invbfs.size());
-    std::sort(list_invbfs.begin(), list_invbfs.end());
 
 
     ReductionCalculator reduced_visited(list_invbfs.size());
-    SubsetsImplicitTrie<N, false, THREADS, true, true>::reduce(list_invbfs_visited, list_invbfs);
+    SubsetsImplicitTrie<N, false, THREADS, true>::reduce(list_invbfs_visited, list_invbfs, &stats_invbfs);
     invbfs_reduction_history.reduced_visited = reduced_visited.calculate(list_invbfs.size());
 
     std::sort(list_invbfs.begin(), list_invbfs.end());
@@ -331,10 +445,7 @@ void MeetInTheMiddle<N, K>::invbfs_step(
 
     list_invbfs_visited.reserve(list_invbfs_visited.size() + list_invbfs.size());
     for (const auto& sub : list_invbfs) list_invbfs_visited.push_back(sub);
-
-    for (auto& sub : list_invbfs) {
-      sub.negate();
-    }
+    stats_invbfs_visited += stats_invbfs;
   }
 
   Logger::debug() << "IBFS reduction |"
@@ -345,22 +456,26 @@ void MeetInTheMiddle<N, K>::invbfs_step(
 
 template<uint N, uint K>
 void MeetInTheMiddle<N, K>::calculate_decision() {
-  constexpr cost_t SET_COST = 512;
   constexpr cost_t ASSUMED_MIN_REDUCTION_VISITED = 0.001;
-  constexpr cost_t DFS_CHECK_COST_WEIGHT = 0.25;
-  constexpr cost_t DFS_SET_COST_WEIGHT = 0.25;
   constexpr cost_t DFS_REDUCTION_OF_REDUCTION = 1.0 / K;
 
+  decision.predicted_cost = 0;
+
   // Trivial decision if small lists
   if (list_bfs.size() <= BFS_SMALL_LIST_SIZE || list_invbfs.size() <= BFS_SMALL_LIST_SIZE || steps_bfs == 0 || steps_invbfs == 0) {
     decision.phase = (list_bfs.size() <= list_invbfs.size() ? Decision::Phase::BFS : Decision::Phase::IBFS);
     return;
   }
+
+  const auto& model = CostModel<N, K>::get(ptrans);
+  const cost_t set_cost = model.set_cost;
+  const cost_t dfs_check_cost_weight = model.dfs_check_cost_weight;
+  const cost_t dfs_set_cost_weight = model.dfs_set_cost_weight;
   
-  const uint64 card_list_bfs = get_cardinalities(list_bfs);
-  const uint64 card_list_invbfs = get_cardinalities(list_invbfs);
-  const uint64 card_trie_visited_bfs = get_cardinalities(list_bfs_visited);
-  const uint64 card_trie_visited_invbfs = get_negated_cardinalities(list_invbfs_visited);
+  const uint64 card_list_bfs = stats_bfs.cardinality;
+  const uint64 card_list_invbfs = stats_invbfs.negated().cardinality;
+  const uint64 card_trie_visited_bfs = stats_bfs_visited.cardinality;
+  const uint64 card_trie_visited_invbfs = stats_invbfs_visited.negated().cardinality;
   const cost_t density_list_bfs = static_cast<cost_t>(card_list_bfs) / (N * list_bfs.size());
   const cost_t density_list_invbfs = static_cast<cost_t>(card_list_invbfs) / (N * list_invbfs.size());
 
@@ -404,20 +519,20 @@ void MeetInTheMiddle<N, K>::calculate_decision() {
   // Step costs
   
   cost_t branching_bfs_visited = K * (1.0 - bfs_reduction_history.reduced_duplicates);
-  cost_t cost_bfs_visited = SET_COST * K * list_bfs.size();
+  cost_t cost_bfs_visited = set_cost * K * list_bfs.size();
   cost_bfs_visited += branching_bfs_visited * list_bfs.size() * get_trie_evn(branching_bfs_visited * list_bfs.size() + list_bfs_visited.size(), density_list_bfs,
       static_cast<cost_t>(branching_bfs_visited * card_list_bfs + card_trie_visited_bfs) / (N * (branching_bfs_visited * list_bfs.size() + list_bfs_visited.size())));
   branching_bfs_visited *= (1.0-bfs_reduction_history.reduced_visited);
   cost_bfs_visited += list_invbfs.size() * get_trie_evn(branching_bfs_visited * list_bfs.size(), density_list_invbfs, density_list_bfs);
   
   cost_t branching_bfs_novisited = K * (1.0 - bfs_reduction_history.reduced_duplicates);
-  cost_t cost_bfs_novisited = SET_COST * K * list_bfs.size();
+  cost_t cost_bfs_novisited = set_cost * K * list_bfs.size();
   cost_bfs_novisited += branching_bfs_novisited * list_bfs.size() * get_trie_evn(branching_bfs_novisited * list_bfs.size(), density_list_bfs, static_cast<cost_t>(branching_bfs_novisited * card_list_bfs) / (N * (branching_bfs_novisited * list_bfs.size())));
   if (decision.bfs_novisited) branching_bfs_novisited *= (1.0 - bfs_reduction_history.reduced_visited); // TODO: use reduced_self instead of visited
   cost_bfs_novisited += list_invbfs.size() * get_trie_evn(branching_bfs_novisited * list_bfs.size(), density_list_invbfs, density_list_bfs);
 
   cost_t branching_invbfs_visited = K * (1.0 - invbfs_reduction_history.reduced_duplicates);
-  cost_t cost_invbfs_visited = SET_COST * K * list_invbfs.size();
+  cost_t cost_invbfs_visited = set_cost * K * list_invbfs.size();
   cost_invbfs_visited += branching_invbfs_visited * list_invbfs.size() * get_trie_evn(branching_invbfs_visited * list_invbfs.size(), 1.0 - density_list_invbfs, 1.0 - density_list_invbfs);
   branching_invbfs_visited *= (1.0 - invbfs_reduction_history.reduced_self);
   cost_invbfs_visited += branching_invbfs_visited * list_invbfs.size() * get_trie_evn(list_invbfs_visited.size(), 1.0 - density_list_invbfs, 1.0 - static_cast<cost_t>(card_trie_visited_invbfs) / (N * list_invbfs_visited.size()));
@@ -425,35 +540,40 @@ void MeetInTheMiddle<N, K>::calculate_decision() {
   cost_invbfs_visited += branching_invbfs_visited * list_invbfs.size() * get_trie_evn(list_bfs.size(), density_list_invbfs, density_list_bfs);
 
   cost_t branching_invbfs_novisited = K * (1.0 - invbfs_reduction_history.reduced_duplicates);
-  cost_t cost_invbfs_novisited = SET_COST * K * list_invbfs.size();
+  cost_t cost_invbfs_novisited = set_cost * K * list_invbfs.size();
   cost_invbfs_novisited += branching_invbfs_novisited * list_invbfs.size() * get_trie_evn(branching_invbfs_novisited * list_invbfs.size(), 1.0 - density_list_invbfs, 1.0 - density_list_invbfs);
   branching_invbfs_novisited *= (1.0 - invbfs_reduction_history.reduced_self);
   cost_invbfs_novisited += branching_invbfs_novisited * list_invbfs.size() * get_trie_evn(list_bfs.size(), density_list_invbfs, density_list_bfs);
 
+  cost_bfs_visited *= bfs_cost_correction;
+  cost_bfs_novisited *= bfs_cost_correction;
+  cost_invbfs_visited *= invbfs_cost_correction;
+  cost_invbfs_novisited *= invbfs_cost_correction;
+
   uint inf_cnt = 0;
   if (decision.bfs_novisited ||
-      get_memory_usage() + synchrolib::get_memory_usage(list_bfs_visited) > max_memory || // reduce
-      get_memory_usage() + 2 * sizeof(Subset<N>) * list_bfs.size() * K > max_memory ||    // next list x 2
+      get_memory_usage() + SubsetsImplicitTrie<N, true>::get_reduce_memory(list_bfs_visited.size()) > max_memory || // reduce
+      get_memory_usage() + 2 * get_expansion_memory(list_bfs.size(), bfs_reduction_history.reduced_duplicates) > max_memory || // next list x 2
       out_of_memory_dfs(list_bfs.size())) {
     cost_bfs_visited = std::numeric_limits<cost_t>::infinity();
     inf_cnt++;
   }
 
-  if (get_memory_usage() - synchrolib::get_memory_usage(list_bfs_visited) + 2 * sizeof(Subset<N>) * list_bfs.size() * K > max_memory || // next list + reduce
+  if (get_memory_usage() - synchrolib::get_memory_usage(list_bfs_visited) + get_reduced_expansion_memory(list_bfs.size(), bfs_reduction_history.reduced_duplicates) > max_memory || // next list + reduce
       out_of_memory_dfs(list_bfs.size())) {
     cost_bfs_novisited = std::numeric_limits<cost_t>::infinity();
     inf_cnt++;
   }
 
   if (decision.invbfs_novisited ||
-      get_memory_usage() + synchrolib::get_memory_usage(list_invbfs_visited) > max_memory || // reduce
-      get_memory_usage() + 2 * sizeof(Subset<N>) * list_invbfs.size() * K > max_memory ||    // next list x 2
+      get_memory_usage() + SubsetsImplicitTrie<N, true>::get_reduce_memory(list_invbfs_visited.size()) > max_memory || // reduce
+      get_memory_usage() + 2 * get_expansion_memory(list_invbfs.size(), invbfs_reduction_history.reduced_duplicates) > max_memory || // next list x 2
       out_of_memory_dfs(list_invbfs.size())) {
     cost_invbfs_visited = std::numeric_limits<cost_t>::infinity();
     inf_cnt++;
   }
 
-  if (get_memory_usage() - synchrolib::get_memory_usage(list_invbfs_visited) + sizeof(Subset<N>) * list_invbfs.size() * K > max_memory || // next list
+  if (get_memory_usage() - synchrolib::get_memory_usage(list_invbfs_visited) + get_reduced_expansion_memory(list_invbfs.size(), invbfs_reduction_history.reduced_duplicates) > max_memory || // next list + reduce
       out_of_memory_dfs(list_invbfs.size())) {
     cost_invbfs_novisited = std::numeric_limits<cost_t>::infinity();
     inf_cnt++;
@@ -464,49 +584,62 @@ void MeetInTheMiddle<N, K>::calculate_decision() {
   // Predictions
 
   cost_t branching_invdfs = std::max(K * (1.0 - invbfs_reduction_history.reduced_duplicates * DFS_REDUCTION_OF_REDUCTION), static_cast<cost_t>(1.0));
+  cost_t branching_dfs = std::max(K * (1.0 - bfs_reduction_history.reduced_duplicates * DFS_REDUCTION_OF_REDUCTION), static_cast<cost_t>(1.0));
   uint64 remaining_iterations = max_reset_threshold - reset_threshold;
   
+  auto get_branching_total_factor = [&](const cost_t branching, const uint depth) { // DFS makes steps without self-reduction, so its correction is between BFS and IBFS
+    return std::sqrt(bfs_cost_correction * invbfs_cost_correction) * branching * (std::pow(branching, depth) - 1.0) / (branching - 1.0);
+  };
   auto get_dfs_total_factor = [&](const uint depth) {
-    return branching_invdfs * (std::pow(branching_invdfs, depth) - 1.0) / (branching_invdfs - 1.0);
+    return get_branching_total_factor(branching_invdfs, depth);
   };
-  const cost_t dfs_subset_cost = SET_COST * DFS_SET_COST_WEIGHT * K / branching_invdfs; // Including reduced duplicates
+  const cost_t dfs_subset_cost = set_cost * dfs_set_cost_weight * K / branching_invdfs; // Including reduced duplicates
   
   cost_t prediction_bfs_visited = cost_bfs_visited +
       list_invbfs.size() * get_dfs_total_factor(remaining_iterations - 1) *
-      (dfs_subset_cost + DFS_CHECK_COST_WEIGHT * get_trie_evn(branching_bfs_visited * list_bfs.size(), density_list_invbfs, density_list_bfs));
+      (dfs_subset_cost + dfs_check_cost_weight * get_trie_evn(branching_bfs_visited * list_bfs.size(), density_list_invbfs, density_list_bfs));
   
   cost_t prediction_bfs_novisited = cost_bfs_novisited +
       list_invbfs.size() * get_dfs_total_factor(remaining_iterations - 1) *
-      (dfs_subset_cost + DFS_CHECK_COST_WEIGHT * get_trie_evn(branching_bfs_novisited * list_bfs.size(), density_list_invbfs, density_list_bfs));
+      (dfs_subset_cost + dfs_check_cost_weight * get_trie_evn(branching_bfs_novisited * list_bfs.size(), density_list_invbfs, density_list_bfs));
   
   cost_t prediction_invbfs_visited = cost_invbfs_visited +
       branching_invbfs_visited * list_invbfs.size() * get_dfs_total_factor(remaining_iterations - 1) *
-      (dfs_subset_cost + DFS_CHECK_COST_WEIGHT * get_trie_evn(list_bfs.size(), density_list_invbfs, density_list_bfs));
+      (dfs_subset_cost + dfs_check_cost_weight * get_trie_evn(list_bfs.size(), density_list_invbfs, density_list_bfs));
   
   cost_t prediction_invbfs_novisited = cost_invbfs_novisited +
       branching_invbfs_novisited * list_invbfs.size() * get_dfs_total_factor(remaining_iterations - 1) *
-      (dfs_subset_cost + DFS_CHECK_COST_WEIGHT * get_trie_evn(list_bfs.size(), density_list_invbfs, density_list_bfs));
+      (dfs_subset_cost + dfs_check_cost_weight * get_trie_evn(list_bfs.size(), density_list_invbfs, density_list_bfs));
   
   cost_t prediction_invdfs =
       list_invbfs.size() * get_dfs_total_factor(remaining_iterations) *
-      (dfs_subset_cost + DFS_CHECK_COST_WEIGHT * get_trie_evn(list_bfs.size(), density_list_invbfs, density_list_bfs));
+      (dfs_subset_cost + dfs_check_cost_weight * get_trie_evn(list_bfs.size(), density_list_invbfs, density_list_bfs));
 
-  Logger::debug() << "bfs_visited: " << prediction_bfs_visited << " bfs_novisited: " << prediction_bfs_novisited << " invbfs_visited: " << prediction_invbfs_visited << " invbfs_novisited: " << prediction_invbfs_novisited << " invdfs: " << prediction_invdfs;
+  // the mirror: list_invbfs is indexed (negated) and the forward images are expanded,
+  // the negated forward sets are the queries
+  cost_t prediction_dfs =
+      list_bfs.size() * get_branching_total_factor(branching_dfs, remaining_iterations) *
+      (set_cost * dfs_set_cost_weight * K / branching_dfs +
+       dfs_check_cost_weight * get_trie_evn(list_invbfs.size(), 1.0 - density_list_bfs, 1.0 - density_list_invbfs));
+
+  Logger::debug() << "bfs_visited: " << prediction_bfs_visited << " bfs_novisited: " << prediction_bfs_novisited << " invbfs_visited: " << prediction_invbfs_visited << " invbfs_novisited: " << prediction_invbfs_novisited << " invdfs: " << prediction_invdfs << " dfs: " << prediction_dfs;
 
   cost_t minimum = std::min(std::min(prediction_bfs_visited, prediction_bfs_novisited), std::min(prediction_invbfs_visited, prediction_invbfs_novisited));
 
+  const auto dfs_phase = (prediction_dfs < prediction_invdfs ? Decision::Phase::FDFS : Decision::Phase::IDFS);
+
   if (inf_cnt == 4) {
     Logger::verbose() << "Ended by memory limit";
-    decision.phase = Decision::Phase::IDFS;
+    decision.phase = dfs_phase;
     return;
   }
 
   Logger::debug() << "BFS steps: " << steps_bfs << " IBFS steps: " << steps_invbfs;
 #if DFS_SHORTCUT
-  if (prediction_invdfs < minimum) {
+  if (std::min(prediction_invdfs, prediction_dfs) < minimum) {
 //  if (last_bfs_list_size < list_bfs.size() && last_invbfs_list_size < list_invbfs.size() && prediction_invdfs < minimum) { // Disabled, since we have reduction estimation
-    Logger::verbose() << "Ended by shortcut (inf " << inf_cnt << "/4)";
-    decision.phase = Decision::Phase::IDFS;
+    Logger::verbose() << "Ended by shortcut (" << (dfs_phase == Decision::Phase::FDFS ? "forward" : "inverse") << ", inf " << inf_cnt << "/4)";
+    decision.phase = dfs_phase;
     return;
   }
 #endif
@@ -514,34 +647,41 @@ void MeetInTheMiddle<N, K>::calculate_decision() {
   if (prediction_bfs_visited < prediction_bfs_novisited && prediction_invbfs_visited < prediction_invbfs_novisited) {
     // If we do not consider novisited, then we choose greedily the cheaper step
     decision.phase = (cost_invbfs_visited < cost_bfs_visited ? Decision::Phase::IBFS : Decision::Phase::BFS);
+    decision.predicted_cost = std::min(cost_invbfs_visited, cost_bfs_visited);
     if (decision.phase == Decision::Phase::IBFS) Logger::debug() << "Decision: IBFS (greedy)"; else Logger::debug() << "Decision: BFS (greedy)"; 
     return;
   }
 
   if (minimum == prediction_bfs_visited) {
     Logger::debug() << "Decision: BFS";
+    decision.predicted_cost = cost_bfs_visited;
     decision.phase = Decision::Phase::BFS;
     return;
   }
   if (minimum == prediction_bfs_novisited) {
     Logger::debug() << "Decision: BFS (novisited)";
+    decision.predicted_cost = cost_bfs_novisited;
     decision.bfs_novisited = true;
     if (!list_bfs_visited.empty()) {
       list_bfs_visited = FastVector<Subset<N>>();
+      stats_bfs_visited = SubsetsStats<N>();
     }
     decision.phase = Decision::Phase::BFS;
     return;
   }
   if (minimum == prediction_invbfs_visited) {
     Logger::debug() << "Decision: IBFS";
+    decision.predicted_cost = cost_invbfs_visited;
     decision.phase = Decision::Phase::IBFS;
     return;
   }
   if (minimum == prediction_invbfs_novisited) {
     Logger::debug() << "Decision: IBFS (novisited)";
+    decision.predicted_cost = cost_invbfs_novisited;
     decision.invbfs_novisited = true;
     if (!list_invbfs_visited.empty()) {
       list_invbfs_visited = FastVector<Subset<N>>();
+      stats_invbfs_visited = SubsetsStats<N>();
     }
     decision.phase = Decision::Phase::IBFS;
     return;
@@ -550,30 +690,39 @@ void MeetInTheMiddle<N, K>::calculate_decision() {
   throw std::runtime_error("Impossible");
 }
 
+// Compares the time of the last step with its predicted cost and updates the
+// correction of the step type (geometric mean of the old correction and the
+// observed ratio, so a single noisy step does not dominate).
 template<uint N, uint K>
-uint64 MeetInTheMiddle<N, K>::get_cardinalities(const FastVector<Subset<N>>& list) {
-  uint64 c = 0;
-  for (const auto& sub : list) {
-    c += sub.size();
+void MeetInTheMiddle<N, K>::update_cost_correction(double step_ns) {
+#if COST_CALIBRATION
+  constexpr double MIN_OBSERVED_NS = 1e7;  // shorter steps are too noisy
+  constexpr cost_t MAX_CORRECTION = 16;
+
+  const auto& model = CostModel<N, K>::get(ptrans);
+  if (decision.predicted_cost <= 0 || model.node_ns <= 0) {
+    return;
   }
-  return c;
-}
 
-template<uint N, uint K>
-uint64 MeetInTheMiddle<N, K>::get_negated_cardinalities(const FastVector<Subset<N>>& list) {
-  uint64 c = 0;
-  for (const auto& sub : list) {
-    c += sub.size();
+  bool bfs = (decision.phase == Decision::Phase::BFS);
+  cost_t& correction = (bfs ? bfs_cost_correction : invbfs_cost_correction);
+  cost_t predicted_ns = decision.predicted_cost * model.node_ns;
+  Logger::debug() << "Cost model | " << (bfs ? "BFS" : "IBFS")
+    << " predicted: " << predicted_ns / 1e6 << "ms"
+    << " actual: " << step_ns / 1e6 << "ms";
+  if (step_ns < MIN_OBSERVED_NS) {
+    return;
   }
-  return static_cast<uint64>(N) * list.size() - c;
+
+  cost_t observed = std::clamp(step_ns / (predicted_ns / correction), 1 / MAX_CORRECTION, MAX_CORRECTION);
+  correction = std::sqrt(correction * observed);
+  Logger::debug() << "Cost model | " << (bfs ? "BFS" : "IBFS") << " correction: " << correction;
+#endif
 }
 
 template<uint N, uint K>
 double MeetInTheMiddle<N, K>::get_trie_evn(const cost_t m, const cost_t p, const cost_t q) {
-  cost_t e = ((1.0 + p) / p + 1.0 / (q - p * q)) *
-      std::pow(m, std::log(1.0 + p) / std::log((1.0 + p) / (1.0 + p * q - q)));
-  if (e >= 0 && e < m * N) return e;
-  return m * N;
+  return synchrolib::get_trie_evn<N>(m, p, q);
 }
 
 template<uint N, uint K>
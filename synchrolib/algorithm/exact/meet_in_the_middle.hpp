@@ -3,10 +3,15 @@
 
 #include <algorithm>
 #include <synchrolib/algorithm/algorithm.hpp>
+#include <synchrolib/algorithm/exact/cost_model.hpp>
+#include <synchrolib/algorithm/exact/expansion.hpp>
 #include <synchrolib/algorithm/exact/utils.hpp>
 #include <synchrolib/data_structures/automaton.hpp>
+#include <synchrolib/data_structures/pairs_bound.hpp>
 #include <synchrolib/data_structures/preprocessed_transition.hpp>
 #include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/data_structures/subsets_check_strategy.hpp>
+#include <synchrolib/data_structures/subsets_stats.hpp>
 #include <synchrolib/data_structures/subsets_trie.hpp>
 #include <synchrolib/utils/connectivity.hpp>
 #include <synchrolib/utils/vector.hpp>
@@ -44,20 +49,46 @@ public:
 
   bool run();
 
+  uint64 get_bfs_steps() const { return steps_bfs; }
+  // list_bfs set contained in a list_invbfs set after the lists met (with FIND_WORD)
+  const std::optional<Subset<N>>& get_meeting_set() const { return meeting_set; }
+  // statistics of list_bfs and list_invbfs after run()
+  const SubsetsStats<N>& get_stats_bfs() const { return stats_bfs; }
+  const SubsetsStats<N>& get_stats_invbfs() const { return stats_invbfs; }
+  // the DFS shortcut over the forward images was predicted cheaper than over the inverse ones
+  bool get_dfs_forward() const { return decision.phase == Decision::Phase::FDFS; }
+
 private:
+  using cost_t = long double;
+
   const Automaton<N, K>& aut;
   const InverseAutomaton<N, K>& invaut;
   const std::array<PreprocessedTransition<N, K>, K>& ptrans;
   const std::array<PreprocessedTransition<N, K>, K>& invptrans;
   uint64& reset_threshold;
   FastVector<Subset<N>>& list_bfs;
-  FastVector<Subset<N>>& list_invbfs;
+  FastVector<Subset<N>>& list_invbfs;  // negated during run(), the inverse transitions commute with negation
 
   uint64 max_reset_threshold;
   size_t max_memory;
 
   FastVector<Subset<N>> list_bfs_visited;
-  FastVector<Subset<N>> list_invbfs_visited;
+  FastVector<Subset<N>> list_invbfs_visited;  // negated
+
+  // maintained with the lists, the inverse ones are of the stored (negated) sets
+  SubsetsStats<N> stats_bfs;
+  SubsetsStats<N> stats_invbfs;
+  SubsetsStats<N> stats_bfs_visited;
+  SubsetsStats<N> stats_invbfs_visited;
+
+  // goal check indexes, valid while the list is unchanged
+  bool list_bfs_sorted;
+  bool list_invbfs_sorted;
+  SubsetsTrie<N, THREADS> trie_bfs;
+  bool trie_bfs_built;
+  std::optional<Subset<N>> meeting_set;
+
+  PairsBound<N, K> pairs_bound;  // list_bfs sets not synchronizable within max_reset_threshold are dropped
 
   uint64 last_reduction_bfs_visited_size;
   uint64 last_reduction_invbfs_visited_size;
@@ -71,11 +102,12 @@ private:
     bool invbfs_novisited;  // list_invbfs_visited cleared
 
     enum class Phase {
-      BFS, IBFS, IDFS
+      BFS, IBFS, FDFS, IDFS
     };
     Phase phase;
+    cost_t predicted_cost;  // cost of the chosen step (0 if not predicted)
 
-    Decision(): bfs_novisited(false), invbfs_novisited(false) {}
+    Decision(): bfs_novisited(false), invbfs_novisited(false), predicted_cost(0) {}
   };
 
   Decision decision;
@@ -101,8 +133,14 @@ private:
 
   ReductionHistory bfs_reduction_history;
   ReductionHistory invbfs_reduction_history;
-  
+
+  // observed / predicted step time, multiplies the predicted costs (with COST_CALIBRATION)
+  cost_t bfs_cost_correction;
+  cost_t invbfs_cost_correction;
+
   size_t get_memory_usage() const override;
+  size_t get_expansion_memory(size_t list_size, double reduced_duplicates) const;
+  size_t get_reduced_expansion_memory(size_t list_size, double reduced_duplicates) const; // with self-reduction
 
   bool out_of_memory_dfs(size_t list_size) const;
 
@@ -113,12 +151,17 @@ private:
   void invbfs_step(
       const Automaton<N, K>& aut, const InverseAutomaton<N, K>& invaut);
 
+  FastVector<Subset<N>> expand(
+      const std::array<PreprocessedTransition<N, K>, K>& trans,
+      const FastVector<Subset<N>>& list, SubsetsStats<N>& stats, double reduced_duplicates) const;
+
+  void remove_distant_bfs();
+  bool check_goal();
+  void save_meeting_set();
 
   void calculate_decision();
+  void update_cost_correction(double step_ns);
 
-  using cost_t = long double;
-  static uint64 get_cardinalities(const FastVector<Subset<N>>& list);
-  static uint64 get_negated_cardinalities(const FastVector<Subset<N>>& list);
   static double get_trie_evn(const cost_t m, const cost_t p, const cost_t q);
 };
 
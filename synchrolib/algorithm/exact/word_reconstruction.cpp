@@ -0,0 +1,257 @@
+#include <jitdefines.hpp>
+#ifdef COMPILE_EXACT
+
+#include "word_reconstruction.hpp"
+
+#include <synchrolib/algorithm/exact/expansion.hpp>
+#include <synchrolib/algorithm/exact/utils.hpp>
+#include <synchrolib/data_structures/preprocessed_transition.hpp>
+#include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/data_structures/subsets_implicit_trie.hpp>
+#include <synchrolib/utils/logger.hpp>
+#include <synchrolib/utils/timer.hpp>
+#include <synchrolib/utils/vector.hpp>
+#include <algorithm>
+#include <cassert>
+
+#ifndef __INTELLISENSE__
+$EXACT_DEF$
+#endif
+
+namespace synchrolib {
+
+template<uint N, uint K>
+WordReconstruction<N, K>::WordReconstruction(
+    const std::array<PreprocessedTransition<N, K>, K>& ptrans,
+    const std::array<PreprocessedTransition<N, K>, K>& invptrans,
+    size_t max_memory):
+  ptrans(ptrans),
+  invptrans(invptrans),
+  max_memory(max_memory) {
+}
+
+template<uint N, uint K>
+std::optional<FastVector<uint>> WordReconstruction<N, K>::run(
+    const Subset<N>& from, const FastVector<Subset<N>>& targets, uint64 length) {
+  Timer timer("word reconstruction");
+  FastVector<uint> word;
+  bool found = reconstruct(from, targets, length, word);
+  list_bfs = list_invbfs = list_bfs_visited = list_invbfs_visited = FastVector<Subset<N>>();
+  bfs_reduced_duplicates = invbfs_reduced_duplicates = 0;
+  clear_layers();
+  if (!found) {
+    return std::nullopt;
+  }
+  return word;
+}
+
+template<uint N, uint K>
+size_t WordReconstruction<N, K>::get_memory_usage() const {
+  return synchrolib::get_memory_usage(list_bfs) +
+      synchrolib::get_memory_usage(list_invbfs) +
+      synchrolib::get_memory_usage(list_bfs_visited) +
+      synchrolib::get_memory_usage(list_invbfs_visited) +
+      layers_memory +
+      synchrolib::get_memory_usage(ptrans) +
+      synchrolib::get_memory_usage(invptrans);
+}
+
+template<uint N, uint K>
+bool WordReconstruction<N, K>::reconstruct(
+    const Subset<N>& from, const FastVector<Subset<N>>& targets, uint64 length, FastVector<uint>& word) {
+  auto reaches = [&targets](const Subset<N>& sub) {
+    return std::any_of(targets.begin(), targets.end(), [&sub](const Subset<N>& t) { return t.is_subset(sub); });
+  };
+
+  if (length == 0) {
+    return reaches(from);
+  }
+  if (length == 1) {
+    for (uint k = 0; k < K; ++k) {
+      Subset<N> next;
+      ptrans[k].apply(from, next);
+      if (reaches(next)) {
+        word.push_back(k);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  auto middle = meet(from, targets, length);
+  if (!middle) {
+    return false;
+  }
+  auto& [sub, depth, prefix, suffix] = *middle;
+  Logger::debug() << "(word) length: " << length << " split: " << depth << " + " << (length - depth)
+                  << (prefix ? " prefix traced" : "") << (suffix ? " suffix traced" : "");
+
+  if (prefix) {
+    word.insert(word.end(), prefix->begin(), prefix->end());
+  } else if (!reconstruct(from, FastVector<Subset<N>>{sub}, depth, word)) {
+    return false;
+  }
+  if (suffix) {
+    word.insert(word.end(), suffix->begin(), suffix->end());
+    return true;
+  }
+  return reconstruct(sub, targets, length - depth, word);
+}
+
+template<uint N, uint K>
+std::optional<typename WordReconstruction<N, K>::Meeting> WordReconstruction<N, K>::meet(
+    const Subset<N>& from, const FastVector<Subset<N>>& targets, uint64 length) {
+  list_bfs = list_bfs_visited = FastVector<Subset<N>>{from};
+  list_invbfs = targets;
+  for (auto& sub : list_invbfs) {
+    sub.negate();
+  }
+  list_invbfs_visited = list_invbfs;
+  clear_layers();
+  store_layer(layers_bfs, list_bfs);
+  store_layer(layers_invbfs, list_invbfs);
+
+  // both sides make at least one step, so both halves are shorter than length,
+  // and a side without layers at most half of them (rounded up)
+  const uint64 max_steps = (length + 1) / 2;
+  uint64 steps_bfs = 0, steps_invbfs = 0;
+  while (steps_bfs + steps_invbfs < length) {
+    bool bfs_open = (steps_bfs < max_steps || !layers_bfs.empty());
+    bool invbfs_open = (steps_invbfs < max_steps || !layers_invbfs.empty());
+    bool forward = (steps_bfs == 0 || (steps_invbfs != 0 &&
+        (!invbfs_open || (bfs_open && list_bfs.size() <= list_invbfs.size()))));
+    if (forward) {
+      bfs_step();
+      steps_bfs++;
+    } else {
+      invbfs_step();
+      steps_invbfs++;
+    }
+  }
+
+  std::sort(list_bfs.begin(), list_bfs.end());
+  auto it = SubsetsImplicitTrie<N, false, THREADS, true, false, true>::check_contains_subset(list_bfs, list_invbfs);
+  if (it == list_invbfs.end()) {
+    return std::nullopt;
+  }
+  for (const auto& sub : list_bfs) {
+    if (sub.is_disjoint(*it)) {
+      Meeting meeting{sub, steps_bfs, std::nullopt, std::nullopt};
+      if (!layers_bfs.empty()) {
+        meeting.prefix = trace(layers_bfs, ptrans, sub);
+        std::reverse(meeting.prefix->begin(), meeting.prefix->end());
+      }
+      if (!layers_invbfs.empty()) {
+        meeting.suffix = trace(layers_invbfs, invptrans, *it);
+      }
+      clear_layers();
+      return meeting;
+    }
+  }
+  return std::nullopt;
+}
+
+// Only the minimal sets not containing a visited set are kept,
+// the images of a subset are subsets of the images.
+template<uint N, uint K>
+void WordReconstruction<N, K>::bfs_step() {
+  list_bfs = expand(ptrans, list_bfs, bfs_reduced_duplicates);
+  if (get_memory_usage() + SubsetsImplicitTrie<N, true>::get_reduce_memory(list_bfs.size()) > max_memory) {
+    throw OutOfMemoryException();
+  }
+
+  SubsetsImplicitTrie<N, true, THREADS>::reduce(list_bfs);
+  SubsetsImplicitTrie<N, false, THREADS>::reduce(list_bfs_visited, list_bfs);
+  list_bfs_visited.insert(list_bfs_visited.end(), list_bfs.begin(), list_bfs.end());
+  if (!layers_bfs.empty()) {
+    store_layer(layers_bfs, list_bfs);
+  }
+}
+
+// Only the maximal sets not contained in a visited set are kept (reduced as complements).
+// The list is stored negated, the inverse transitions commute with negation.
+template<uint N, uint K>
+void WordReconstruction<N, K>::invbfs_step() {
+  list_invbfs = expand(invptrans, list_invbfs, invbfs_reduced_duplicates);
+  if (get_memory_usage() + SubsetsImplicitTrie<N, true>::get_reduce_memory(list_invbfs.size()) > max_memory) {
+    throw OutOfMemoryException();
+  }
+
+  SubsetsImplicitTrie<N, true, THREADS>::reduce(list_invbfs);
+  SubsetsImplicitTrie<N, false, THREADS>::reduce(list_invbfs_visited, list_invbfs);
+  list_invbfs_visited.insert(list_invbfs_visited.end(), list_invbfs.begin(), list_invbfs.end());
+  if (!layers_invbfs.empty()) {
+    store_layer(layers_invbfs, list_invbfs);
+  }
+}
+
+template<uint N, uint K>
+FastVector<Subset<N>> WordReconstruction<N, K>::expand(const std::array<PreprocessedTransition<N, K>, K>& trans,
+    const FastVector<Subset<N>>& list, double& reduced_duplicates) const {
+  auto fits = [this](size_t capacity, size_t buffer_size) {
+    return get_memory_usage() + sizeof(Subset<N>) * (capacity + buffer_size) <= max_memory;
+  };
+  auto list_next = expand_keep_unique<N, K>(trans, list, reduced_duplicates, fits);
+  if (!list.empty()) {
+    reduced_duplicates = 1.0 - static_cast<double>(list_next.size()) / (K * list.size());
+  }
+  return list_next;
+}
+
+// Once the layers of a side do not fit, they are dropped until the next meet
+// (an empty vector marks such a side).
+template<uint N, uint K>
+void WordReconstruction<N, K>::store_layer(
+    FastVector<FastVector<Subset<N>>>& layers, const FastVector<Subset<N>>& list) {
+  size_t memory = synchrolib::get_memory_usage(list);
+  if (layers_memory + memory > max_memory / LAYERS_MEMORY_FRACTION) {
+    for (const auto& layer : layers) {
+      layers_memory -= synchrolib::get_memory_usage(layer);
+    }
+    layers = FastVector<FastVector<Subset<N>>>();
+    return;
+  }
+  layers.push_back(list);
+  layers_memory += memory;
+}
+
+template<uint N, uint K>
+void WordReconstruction<N, K>::clear_layers() {
+  layers_bfs = layers_invbfs = FastVector<FastVector<Subset<N>>>();
+  layers_memory = 0;
+}
+
+// Each set of a layer is the image of a set of the previous one (the reductions only
+// remove sets), so the path is followed back by looking for an exact preimage.
+template<uint N, uint K>
+FastVector<uint> WordReconstruction<N, K>::trace(const FastVector<FastVector<Subset<N>>>& layers,
+    const std::array<PreprocessedTransition<N, K>, K>& trans, Subset<N> sub) {
+  FastVector<uint> letters;
+  for (size_t i = layers.size() - 1; i > 0; --i) {
+    bool found = false;
+    for (uint k = 0; k < K && !found; ++k) {
+      for (const auto& prev : layers[i - 1]) {
+        Subset<N> next;
+        trans[k].apply(prev, next);
+        if (next == sub) {
+          letters.push_back(k);
+          sub = prev;
+          found = true;
+          break;
+        }
+      }
+    }
+    assert(found);
+  }
+  return letters;
+}
+
+template class WordReconstruction<AUT_N, AUT_K>;
+
+}  // namespace synchrolib
+
+#ifndef __INTELLISENSE__
+$EXACT_UNDEF$
+#endif
+
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+#include <jitdefines.hpp>
+
+#include <synchrolib/algorithm/exact/utils.hpp>
+#include <synchrolib/data_structures/preprocessed_transition.hpp>
+#include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/vector.hpp>
+#include <synchrolib/utils/memory.hpp>
+#include <array>
+#include <optional>
+
+#ifndef __INTELLISENSE__
+$EXACT_DEF$
+#endif
+
+namespace synchrolib {
+
+// Finds a word of a known shortest length. Meet in the middle from a single set
+// to a list of targets gives a set in the middle of some word. The layers of each
+// side are kept while they fit in a part of the memory, the letters of such a
+// side are read back from them. The other halves are solved recursively, a side
+// without layers makes at most half of the steps, so the recursion is logarithmic
+// in the length. Both halves are shortest words again, so sets dominated by the
+// visited ones can be dropped as in MeetInTheMiddle. The top level dominates the cost.
+template <uint N, uint K>
+class WordReconstruction : public MemoryUsage {
+public:
+  WordReconstruction(
+      const std::array<PreprocessedTransition<N, K>, K>& ptrans,
+      const std::array<PreprocessedTransition<N, K>, K>& invptrans,
+      size_t max_memory);
+
+  // word w of the given length such that from.w is contained in one of the targets
+  // (nullopt if it does not exist), throws OutOfMemoryException
+  std::optional<FastVector<uint>> run(
+      const Subset<N>& from, const FastVector<Subset<N>>& targets, uint64 length);
+
+private:
+  const std::array<PreprocessedTransition<N, K>, K>& ptrans;
+  const std::array<PreprocessedTransition<N, K>, K>& invptrans;
+  size_t max_memory;
+
+  FastVector<Subset<N>> list_bfs;
+  FastVector<Subset<N>> list_invbfs;          // negated
+  FastVector<Subset<N>> list_bfs_visited;
+  FastVector<Subset<N>> list_invbfs_visited;  // negated
+  double bfs_reduced_duplicates = 0;     // fraction of the images of the last step
+  double invbfs_reduced_duplicates = 0;
+
+  // the lists after each step (the first one is the start), empty if they did not fit
+  FastVector<FastVector<Subset<N>>> layers_bfs;
+  FastVector<FastVector<Subset<N>>> layers_invbfs;  // negated
+  size_t layers_memory = 0;
+  static constexpr size_t LAYERS_MEMORY_FRACTION = 4;  // of max_memory
+
+  // a set in the middle of a word, with the letters of the parts read from the layers
+  // (nullopt if the part has to be reconstructed)
+  struct Meeting {
+    Subset<N> set;
+    uint64 depth;
+    std::optional<FastVector<uint>> prefix;
+    std::optional<FastVector<uint>> suffix;
+  };
+
+  size_t get_memory_usage() const override;
+
+  bool reconstruct(
+      const Subset<N>& from, const FastVector<Subset<N>>& targets, uint64 length, FastVector<uint>& word);
+
+  // meet in the middle with exactly length steps
+  std::optional<Meeting> meet(
+      const Subset<N>& from, const FastVector<Subset<N>>& targets, uint64 length);
+
+  void bfs_step();
+  void invbfs_step();
+
+  // see expand_keep_unique(), reduced_duplicates is the expected fraction, updated to the observed one
+  FastVector<Subset<N>> expand(const std::array<PreprocessedTransition<N, K>, K>& trans,
+      const FastVector<Subset<N>>& list, double& reduced_duplicates) const;
+
+  void store_layer(FastVector<FastVector<Subset<N>>>& layers, const FastVector<Subset<N>>& list);
+  void clear_layers();
+
+  // letters leading from the first layer to sub in the last one, in the order of the layers
+  static FastVector<uint> trace(const FastVector<FastVector<Subset<N>>>& layers,
+      const std::array<PreprocessedTransition<N, K>, K>& trans, Subset<N> sub);
+};
+
+}  // namespace synchrolib
+
+#ifndef __INTELLISENSE__
+$EXACT_UNDEF$
+#endif
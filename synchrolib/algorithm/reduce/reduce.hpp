@@ -5,7 +5,11 @@
 #include <synchrolib/data_structures/preprocessed_transition.hpp>
 #include <synchrolib/data_structures/subset.hpp>
 #include <synchrolib/utils/vector.hpp>
+#include <synchrolib/data_structures/subsets_check_strategy.hpp>
 #include <synchrolib/data_structures/subsets_implicit_trie.hpp>
+#include <synchrolib/data_structures/subsets_scan.hpp>
+#include <synchrolib/data_structures/subsets_stats.hpp>
+#include <synchrolib/data_structures/subsets_trie.hpp>
 #include <synchrolib/utils/connectivity.hpp>
 #include <synchrolib/utils/distribution.hpp>
 #include <synchrolib/utils/general.hpp>
@@ -102,6 +106,7 @@ private:
   VarAutomaton aut_reduced;
   FastVector<Subset<N>> list_bfs;
   FastVector<Subset<N>> list_bfs_visited;
+  SubsetsStats<N> stats_bfs_visited;
 
   FastVector<Subset<N>> singletons;
 
@@ -203,13 +208,14 @@ private:
 
     list_bfs = std::move(list_next);
 
-    SubsetsImplicitTrie<N, false, THREADS>::reduce(list_bfs_visited, list_bfs);
+    reduce_visited();
     SubsetsImplicitTrie<N, true, THREADS>::reduce(list_bfs);
 
     list_bfs_visited.reserve(list_bfs_visited.size() + list_bfs.size());
     for (const auto& sub : list_bfs) {
       list_bfs_visited.push_back(sub);
     }
+    stats_bfs_visited.add(list_bfs.begin(), list_bfs.end());
 
     for (const auto& sub : list_bfs) {
       if (sub.size() == 1)
@@ -220,6 +226,39 @@ private:
     //return std::any_of(ret.begin(), ret.end(), [](bool x) { return x; });
   }
 
+  // Removes the sets of list_bfs containing a visited set. The visited list is
+  // indexed, the index type is chosen from the list statistics.
+  void reduce_visited() {
+    using Strategy = SubsetsCheckStrategy<N, THREADS>;
+    SubsetsStats<N> stats_bfs(list_bfs.begin(), list_bfs.end());
+    auto strategy = Strategy::template choose<false>(
+        stats_bfs_visited, stats_bfs, typename Strategy::ListState(), typename Strategy::ListState());
+    Logger::debug() << "Visited check | " << strategy.describe();
+
+    auto remove_if = [this](auto pred) {
+      list_bfs.resize(std::distance(list_bfs.begin(), std::remove_if(list_bfs.begin(), list_bfs.end(), pred)));
+    };
+    switch (strategy.index) {
+      case Strategy::Index::IMPLICIT_TRIE:
+        SubsetsImplicitTrie<N, false, THREADS>::reduce(list_bfs_visited, list_bfs);
+        break;
+
+      case Strategy::Index::TRIE: {
+        SubsetsTrie<N, THREADS> trie;
+        trie.build(std::move(list_bfs_visited));
+        remove_if([&trie](Subset<N> sub) { return trie.contains_subset_of(&sub, &sub + 1); });
+        list_bfs_visited = trie.release_subsets();
+        break;
+      }
+
+      case Strategy::Index::SCAN: {
+        SubsetsScan<N> scan(list_bfs_visited.begin(), list_bfs_visited.end());
+        remove_if([&scan](const Subset<N>& sub) { return scan.contains_subset_of(sub); });
+        break;
+      }
+    }
+  }
+
   static FastVector<FastVector<bool>> to_vector(
       const FastVector<Subset<N>>& subs) {
     FastVector<FastVector<bool>> ret(subs.size(), FastVector<bool>(N));
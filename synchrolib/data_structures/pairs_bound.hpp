@@ -0,0 +1,110 @@
+#pragma once
+#include <synchrolib/data_structures/automaton.hpp>
+#include <synchrolib/data_structures/pairs_tree.hpp>
+#include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/vector.hpp>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <map>
+
+namespace synchrolib {
+
+// Lower bound on the length of a word synchronizing a set: the length of the
+// shortest word merging its most distant pair (computed by PairsTree). Sets
+// exceeding the remaining length (the budget) can be dropped from a search.
+// For a budget, far[n] holds the states too distant from n, so a set is checked
+// with one intersection per state having any too distant pair. The tables are
+// built once per budget value and kept, as the searches step back and forth
+// over a few budgets.
+template <uint N, uint K>
+class PairsBound : NonCopyable {
+public:
+  static constexpr uint INFINITE = std::numeric_limits<uint>::max();  // the pair cannot be merged
+
+  void initialize(const Automaton<N, K>& aut) {
+    PairsTree<N, K> tree;
+    tree.initialize(aut);
+
+    lengths.resize(N * N);
+    max_length = 0;
+    for (uint n1 = 0; n1 < N; ++n1) {
+      for (uint n2 = 0; n2 < N; ++n2) {
+        uint length = (n1 == n2 ? 0 : tree.get_length(n1, n2));
+        if (n1 != n2 && length == 0) {
+          length = INFINITE;
+        }
+        lengths[n1 * N + n2] = length;
+        max_length = std::max(max_length, length);
+      }
+    }
+    tables.clear();
+    current = nullptr;
+    budget = INFINITE;
+  }
+
+  uint get_max_length() const { return max_length; }
+
+  void set_budget(uint64 new_budget) {
+    if (new_budget == budget) {
+      return;
+    }
+    budget = new_budget;
+    if (!prunes()) {
+      return;
+    }
+    auto [it, inserted] = tables.try_emplace(budget);
+    current = &it->second;
+    if (!inserted) {
+      return;
+    }
+    auto& [far, active] = it->second;
+    active = Subset<N>::Empty();
+    for (uint n1 = 0; n1 < N; ++n1) {
+      far[n1] = Subset<N>::Empty();
+      for (uint n2 = 0; n2 < N; ++n2) {
+        if (lengths[n1 * N + n2] > budget) {
+          far[n1].set(n2);
+          active.set(n1);
+        }
+      }
+    }
+  }
+
+  // some set can exceed the budget
+  bool prunes() const { return budget < max_length; }
+
+  // some pair of sub needs a word longer than the budget
+  bool exceeds(const Subset<N>& sub) const {
+    const auto& [far, active] = *current;
+    for (uint b = 0; b < Subset<N>::buckets(); b++) {
+      uint n = b * SUBSETS_BITS;
+      uint64 c = sub.v[b] & active.v[b];
+      while (c) {
+        uint shift = __builtin_ctzll(c);
+        c >>= shift;
+        n += shift;
+        if (!sub.is_disjoint(far[n])) {
+          return true;
+        }
+        c ^= 1;
+      }
+    }
+    return false;
+  }
+
+private:
+  FastVector<uint> lengths;  // of the shortest words merging the pairs
+  uint max_length = 0;
+  uint64 budget = INFINITE;
+
+  struct Tables {
+    std::array<Subset<N>, N> far;
+    Subset<N> active;  // states with a pair exceeding the budget
+  };
+  std::map<uint64, Tables> tables;  // by budget
+  const Tables* current = nullptr;  // for the budget, set while prunes()
+};
+
+}  // namespace synchrolib
@@ -69,22 +69,11 @@ void PreprocessedTransition<N, K>::apply(const Subset<N>* from, Subset<N>* to, s
   }
 #else
   if (THREADS > 1 && cnt > 256) {
-    ThreadPool pool;
-    pool.start(THREADS);
-    for (size_t t = 0; t < THREADS; ++t) {
-      auto it = from + (cnt * t / THREADS);
-      auto end = from + (cnt * (t + 1) / THREADS);
-      auto out = to + (cnt * t / THREADS);
-
-      pool.add_job([this, it, end, out] () mutable {
-        while (it != end) {
-          this->apply(*it, *out);
-          ++it;
-          ++out;
-        }
-      });
-    }
-    pool.wait();
+    parallel_for(0, cnt, 128, [this, from, to] (size_t lo, size_t hi) {
+      for (size_t i = lo; i < hi; ++i) {
+        this->apply(from[i], to[i]);
+      }
+    });
   } else {
     for (size_t i = 0; i < cnt; ++i, ++from, ++to) {
       apply(*from, *to);
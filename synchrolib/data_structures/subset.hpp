@@ -121,7 +121,7 @@ struct Subset {
   }
 
   template <typename T>
-  __attribute__((hot)) inline void count(T* acc) {
+  __attribute__((hot)) inline void count(T* acc, T delta = 1) const {
     for (uint b = 0; b < buckets(); b++) {
       uint n = b * SUBSETS_BITS;
       uint64 c = v[b];
@@ -129,7 +129,7 @@ struct Subset {
         uint shift = __builtin_ctzll(c);
         c >>= shift;
         n += shift;
-        ++acc[n];
+        acc[n] += delta;
         c ^= 1;
       }
     }
@@ -213,6 +213,12 @@ struct Subset {
       const Subset<S> &subset) const {
     return *this != subset && is_subset(subset);
   }
+  __attribute__((pure)) __attribute__((hot)) inline bool is_disjoint(
+      const Subset<S> &subset) const {
+    for (uint b = 0; b < buckets(); b++)
+      if (subset.v[b] & v[b]) return false;
+    return true;
+  }
 };
 
 }  // namespace synchrolib
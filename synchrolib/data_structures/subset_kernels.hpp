@@ -0,0 +1,206 @@
+#pragma once
+#include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/utils/general.hpp>
+#include <algorithm>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace synchrolib {
+
+// Relation of a set of an array to the query set x.
+enum class SetRelation {
+  SUBSET_OF,      // set is a subset of x (a proper one with Proper)
+  SUPERSET_OF,    // set is a superset of x (a proper one with Proper)
+  DISJOINT_WITH,  // set is disjoint with x (Proper not available)
+};
+
+// Inclusion tests of one set against a whole array (a trie leaf, a bucket of a scan),
+// selected at compile time by -march. With AVX-512 or AVX2 and 1 or 2 words per set, the
+// array is read as a flat array of words against x repeated, so one register tests
+// several sets. Otherwise, and for the tail, the scalar loop is used: for larger sets
+// it mostly stops at the first word, which the vector tests can't beat (measured by
+// scripts/subset_kernels_bench.cpp).
+template <uint N>
+class SubsetKernels {
+public:
+  // index of the first of the cnt sets in relation R with x, cnt if none
+  template <SetRelation R, bool Proper=false>
+  static size_t find_first(const Subset<N>& x, const Subset<N>* sets, size_t cnt) {
+    static_assert(R != SetRelation::DISJOINT_WITH || !Proper,
+      "Proper is not available with DISJOINT_WITH");
+
+    size_t i = 0;
+#if defined(__AVX512F__)
+    if constexpr (W == 1 || W == 2) {
+      i = find_first_packed_avx512<R, Proper>(x, sets, cnt);
+    }
+#elif defined(__AVX2__)
+    if constexpr (W == 1 || W == 2) {
+      i = find_first_packed_avx2<R, Proper>(x, sets, cnt);
+    }
+#endif
+    for (; i < cnt; ++i) {
+      if (in_relation<R, Proper>(x, sets[i])) {
+        return i;
+      }
+    }
+    return cnt;
+  }
+
+  // Bit-sliced sets: the columns of up to 64 sets, word i holding bit i of every set
+  // (bit j for the j-th set). Writes the N words of columns.
+  static void slice(const Subset<N>* sets, size_t cnt, uint64* columns) {
+    std::fill(columns, columns + N, 0);
+    for (size_t j = 0; j < cnt; ++j) {
+      for (uint b = 0; b < W; ++b) {
+        for (uint64 word = sets[j].v[b]; word; word &= word - 1) {
+          columns[b * SUBSETS_BITS + __builtin_ctzll(word)] |= 1ULL << j;
+        }
+      }
+    }
+  }
+
+  // the candidates (bits of sliced sets) in relation R with x (not only the proper ones),
+  // one AND per element of x (of its complement for SUBSET_OF) until none are left
+  template <SetRelation R>
+  static uint64 filter_sliced(const Subset<N>& x, const uint64* columns, uint64 candidates) {
+    for (uint b = 0; b < W && candidates; ++b) {
+      uint64 word = x.v[b];
+      if constexpr (R == SetRelation::SUBSET_OF) {
+        word = ~word;
+        if (b == W - 1 && N % SUBSETS_BITS) {
+          word &= (1ULL << (N % SUBSETS_BITS)) - 1;
+        }
+      }
+      for (; word && candidates; word &= word - 1) {
+        auto column = columns[b * SUBSETS_BITS + __builtin_ctzll(word)];
+        candidates &= (R == SetRelation::SUPERSET_OF ? column : ~column);
+      }
+    }
+    return candidates;
+  }
+
+  // whether filter_sliced<R> is expected to be faster than the tests of the rows for
+  // cnt sets of the given total size: each AND drops the candidates with the element
+  // (without it for SUPERSET_OF), at least 1 / SLICED_MIN_DROP of them on average
+  template <SetRelation R>
+  static bool slicing_pays_off(uint64 elements, uint64 cnt) {
+    uint64 dropping = (R == SetRelation::SUPERSET_OF ? cnt * N - elements : elements);
+    return dropping * SLICED_MIN_DROP >= cnt * N;
+  }
+
+  template <SetRelation R, bool Proper=false>
+  static bool in_relation(const Subset<N>& x, const Subset<N>& set) {
+    if constexpr (R == SetRelation::SUBSET_OF) {
+      return Proper ? x.is_proper_subset(set) : x.is_subset(set);
+    } else if constexpr (R == SetRelation::SUPERSET_OF) {
+      return Proper ? set.is_proper_subset(x) : set.is_subset(x);
+    } else {
+      return x.is_disjoint(set);
+    }
+  }
+
+private:
+  static constexpr uint W = Subset<N>::buckets();
+  static constexpr uint SLICED_MIN_DROP = 8;
+
+  // within each group of G bits (aligned), the first bit becomes the AND (the OR) of the group
+  template <uint G>
+  static uint fold_and(uint bits) {
+    for (uint s = 1; s < G; s *= 2) bits &= bits >> s;
+    return bits;
+  }
+  template <uint G>
+  static uint fold_or(uint bits) {
+    for (uint s = 1; s < G; s *= 2) bits |= bits >> s;
+    return bits;
+  }
+
+  // first bit of each group of G bits out of L
+  template <uint G, uint L>
+  static constexpr uint group_mask() {
+    uint mask = 0;
+    for (uint b = 0; b < L; b += G) mask |= 1u << b;
+    return mask;
+  }
+
+#if defined(__AVX512F__)
+  // lanes where the set breaks the relation (a word of the set or of x not in the
+  // common part, or a common word for DISJOINT_WITH)
+  template <SetRelation R>
+  static __mmask8 violations_avx512(__m512i set, __m512i x) {
+    if constexpr (R == SetRelation::SUBSET_OF) {
+      return _mm512_cmpneq_epi64_mask(_mm512_and_si512(set, x), set);
+    } else if constexpr (R == SetRelation::SUPERSET_OF) {
+      return _mm512_cmpneq_epi64_mask(_mm512_and_si512(set, x), x);
+    } else {
+      return _mm512_test_epi64_mask(set, x);
+    }
+  }
+
+  template <SetRelation R, bool Proper>
+  static size_t find_first_packed_avx512(const Subset<N>& x, const Subset<N>* sets, size_t cnt) {
+    constexpr uint PER = 8 / W;
+    alignas(64) uint64 pattern[8];
+    for (uint l = 0; l < 8; ++l) pattern[l] = x.v[l % W];
+    const __m512i xv = _mm512_load_si512(pattern);
+    auto words = reinterpret_cast<const uint64*>(sets);
+
+    size_t i = 0;
+    for (; i + PER <= cnt; i += PER) {
+      __m512i set = _mm512_loadu_si512(words + i * W);
+      uint ok = fold_and<W>(~violations_avx512<R>(set, xv) & 0xFF);
+      if constexpr (Proper) {
+        ok &= fold_or<W>(_mm512_cmpneq_epi64_mask(set, xv));
+      }
+      ok &= group_mask<W, 8>();
+      if (ok) {
+        return i + __builtin_ctz(ok) / W;
+      }
+    }
+    return i;
+  }
+#elif defined(__AVX2__)
+  // lanes (bits of a 4-bit mask) where the set breaks the relation
+  template <SetRelation R>
+  static uint violations_avx2(__m256i set, __m256i x) {
+    __m256i d;
+    if constexpr (R == SetRelation::SUBSET_OF) {
+      d = _mm256_andnot_si256(x, set);
+    } else if constexpr (R == SetRelation::SUPERSET_OF) {
+      d = _mm256_andnot_si256(set, x);
+    } else {
+      d = _mm256_and_si256(set, x);
+    }
+    auto zero = _mm256_cmpeq_epi64(d, _mm256_setzero_si256());
+    return ~_mm256_movemask_pd(_mm256_castsi256_pd(zero)) & 0xF;
+  }
+
+  template <SetRelation R, bool Proper>
+  static size_t find_first_packed_avx2(const Subset<N>& x, const Subset<N>* sets, size_t cnt) {
+    constexpr uint PER = 4 / W;
+    alignas(32) uint64 pattern[4];
+    for (uint l = 0; l < 4; ++l) pattern[l] = x.v[l % W];
+    const __m256i xv = _mm256_load_si256(reinterpret_cast<const __m256i*>(pattern));
+    auto words = reinterpret_cast<const uint64*>(sets);
+
+    size_t i = 0;
+    for (; i + PER <= cnt; i += PER) {
+      __m256i set = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + i * W));
+      uint ok = fold_and<W>(~violations_avx2<R>(set, xv) & 0xF);
+      if constexpr (Proper) {
+        auto equal = _mm256_cmpeq_epi64(set, xv);
+        ok &= fold_or<W>(~_mm256_movemask_pd(_mm256_castsi256_pd(equal)) & 0xF);
+      }
+      ok &= group_mask<W, 4>();
+      if (ok) {
+        return i + __builtin_ctz(ok) / W;
+      }
+    }
+    return i;
+  }
+#endif
+};
+
+}  // namespace synchrolib
@@ -5,6 +5,7 @@
 #include <synchrolib/utils/vector.hpp>
 #include <functional>
 #include <bitset>
+#include <cmath>
 
 namespace synchrolib {
 
@@ -114,6 +115,16 @@ void sort_sets_cardinality_descending(typename FastVector<Subset<N>>::iterator b
   sort_sets_cardinality_descending<N, Ascending>(begin, end, nullptr);
 }
 
+// expected number of visited nodes in an implicit trie of m sets with density q,
+// queried with a set of density p
+template <uint N>
+double get_trie_evn(const long double m, const long double p, const long double q) {
+  long double e = ((1.0 + p) / p + 1.0 / (q - p * q)) *
+      std::pow(m, std::log(1.0 + p) / std::log((1.0 + p) / (1.0 + p * q - q)));
+  if (e >= 0 && e < m * N) return e;
+  return m * N;
+}
+
 template <uint S>
 __attribute__((pure, hot)) bool subsets_size_invlex_comparator(
     const Subset<S> &s1, const Subset<S> &s2) {
@@ -0,0 +1,88 @@
+#pragma once
+#include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/vector.hpp>
+#include <synchrolib/utils/memory.hpp>
+#include <algorithm>
+
+namespace synchrolib {
+
+// Fixed-size hash table of sets with a value (e.g. the remaining depth at which a
+// set was refuted). A set hashes to a bucket of WAYS entries, a new set replaces
+// the entry with the smallest value there (or is dropped if its value is smaller).
+// The sets are compared in full, so a hit is never a false positive.
+template <uint N>
+class SubsetsCache : public MemoryUsage {
+public:
+  static constexpr uint WAYS = 2;
+  static constexpr uint NONE = 0;  // value of a set not in the cache
+
+  void initialize(size_t max_bytes) {
+    size_t buckets = 1;
+    while (2 * buckets * WAYS * sizeof(Entry) <= max_bytes) {
+      buckets *= 2;
+    }
+    mask = buckets - 1;
+    entries.resize(buckets * WAYS);
+    for (auto& entry : entries) {
+      entry.value = NONE;
+    }
+    if (max_bytes < WAYS * sizeof(Entry)) {
+      entries.clear();
+    }
+  }
+
+  bool empty() const { return entries.empty(); }
+
+  static size_t get_entry_size() { return sizeof(Entry); }
+
+  size_t get_memory_usage() const override {
+    return synchrolib::get_memory_usage(entries);
+  }
+
+  uint get(const Subset<N>& sub) const {
+    const Entry* bucket = entries.data() + (hash(sub) & mask) * WAYS;
+    for (uint w = 0; w < WAYS; ++w) {
+      if (bucket[w].value != NONE && bucket[w].set == sub) {
+        return bucket[w].value;
+      }
+    }
+    return NONE;
+  }
+
+  void insert(const Subset<N>& sub, uint value) {
+    Entry* bucket = entries.data() + (hash(sub) & mask) * WAYS;
+    Entry* victim = bucket;
+    for (uint w = 0; w < WAYS; ++w) {
+      if (bucket[w].value != NONE && bucket[w].set == sub) {
+        bucket[w].value = std::max(bucket[w].value, value);
+        return;
+      }
+      if (bucket[w].value < victim->value) {
+        victim = bucket + w;
+      }
+    }
+    if (victim->value <= value) {
+      *victim = {sub, value};
+    }
+  }
+
+private:
+  struct Entry {
+    Subset<N> set;
+    uint value;
+  };
+
+  FastVector<Entry> entries;
+  size_t mask = 0;
+
+  static size_t hash(const Subset<N>& sub) {
+    uint64 h = 0;
+    for (uint b = 0; b < Subset<N>::buckets(); ++b) {
+      h = (h ^ sub.v[b]) * 0x9E3779B97F4A7C15ULL;
+    }
+    return h ^ (h >> 29);
+  }
+};
+
+}  // namespace synchrolib
@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include <iostream>
 #include <vector>
 #include <mutex>
@@ -9,9 +10,12 @@
 
 #include <synchrolib/data_structures/automaton.hpp>
 #include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/data_structures/subset_kernels.hpp>
+#include <synchrolib/data_structures/subsets_stats.hpp>
 #include <synchrolib/utils/general.hpp>
 #include <synchrolib/utils/vector.hpp>
 #include <synchrolib/utils/memory.hpp>
+#include <synchrolib/utils/thread_pool.hpp>
 #include <synchrolib/utils/timer.hpp>
 
 // TODO: use GPU_MEMORY
@@ -21,54 +25,129 @@
 
 namespace synchrolib {
 
-template <uint N, bool Proper=false, uint Threads=1, bool SortUniqueDone=false, bool ThreadShuffle=false>
+// ComplementCheck: the check sets are stored as complements, so "contains" means
+// "is disjoint with". ComplementSet (requires ComplementCheck): both are stored as
+// complements, so "contains" means "is contained in", and set is sorted by the
+// complements (in the decreasing order, see Compare). Stored sets are never negated.
+template <uint N, bool Proper=false, uint Threads=1, bool SortUniqueDone=false,
+          bool ComplementSet=false, bool ComplementCheck=ComplementSet>
 class SubsetsImplicitTrie {
+  static_assert(ComplementCheck || !ComplementSet,
+    "ComplementSet requires ComplementCheck");
+  static_assert(ComplementSet || !ComplementCheck || !Proper,
+    "Proper is not available with ComplementCheck only");
+
 public:
   using Iterator = typename FastVector<Subset<N>>::iterator;
 
+  // order of the complements if ComplementSet
+  struct Compare {
+    bool operator()(const Subset<N>& a, const Subset<N>& b) const {
+      return ComplementSet ? b < a : a < b;
+    }
+  };
+
   static Iterator check_contains_subset(FastVector<Subset<N>>& set, FastVector<Subset<N>>& check) {
     if constexpr (!SortUniqueDone) {
-      sort_keep_unique(set);
-      sort_keep_unique(check);
+      sort_keep_unique(set, Compare{});
+      sort_keep_unique(check, Compare{});
+    }
+
+    return check_contains_subset_dispatch(set.begin(), set.end(), check.begin(), check.end());
+  }
+
+  // checks if any of the check sets contains a subset from set, stops at the first one found
+  static bool any_contains_subset(FastVector<Subset<N>>& set, FastVector<Subset<N>>& check) {
+    if constexpr (!SortUniqueDone) {
+      sort_keep_unique(set, Compare{});
+      sort_keep_unique(check, Compare{});
     }
 
     if constexpr (Threads == 1 || (GPU && (THREADS == 1))) {
-      return check_contains_subset_singlethreaded(set, check);
+      return any_contains_subset_singlethreaded(set, check);
     } else {
       if (std::max(set.size(), check.size()) < 256) {
-        return check_contains_subset_singlethreaded(set, check);
+        return any_contains_subset_singlethreaded(set, check);
       } else {
-        return check_contains_subset_multithreaded(set, check);
+        return any_contains_subset_multithreaded(set, check);
       }
     }
   }
 
-  static void reduce(FastVector<Subset<N>>& set) {
+  // In the sorted order a set precedes all its supersets, so the list is reduced in place
+  // chunk by chunk: a chunk is checked against the kept prefix followed by the chunk itself,
+  // and the remaining sets are written back right after the prefix (the list stays sorted).
+  // Only one chunk is copied, see get_reduce_memory().
+  // The removed sets (and duplicates) are removed from stats if given.
+  static void reduce(FastVector<Subset<N>>& set, SubsetsStats<N>* stats = nullptr) {
     static_assert(Proper,
       "reduce(FastVector<Subset<N>>&) available only with Proper=true");
 
     Timer timer("reduce one");
     if (set.empty()) return;
 
-    auto cpy = set; // TODO: somehow opt memory?
-    auto it = check_contains_subset(cpy, set);
-    set.resize(std::distance(set.begin(), it));
+    if constexpr (!SortUniqueDone) {
+      sort_unique(set, stats);
+    }
+
+    FastVector<Subset<N>> chunk(get_reduce_chunk_size(set.size()));
+    auto kept = set.begin();
+    for (auto pos = set.begin(); pos != set.end();) {
+      size_t count = std::min(chunk.size(), static_cast<size_t>(std::distance(pos, set.end())));
+      chunk.resize(count);
+      std::copy(pos, pos + count, chunk.begin());
+      if (kept != pos) {
+        std::copy(pos, pos + count, kept);
+      }
+      pos += count;
+
+      auto it = check_contains_subset_dispatch(set.begin(), kept + count, chunk.begin(), chunk.end());
+      if (stats) stats->remove(it, chunk.end());
+      std::sort(chunk.begin(), it, Compare{});
+      kept = std::copy(chunk.begin(), it, kept);
+    }
+    set.resize(std::distance(set.begin(), kept));
   }
 
-  static void reduce(FastVector<Subset<N>>& set, FastVector<Subset<N>>& vec) {
+  // additional memory used by reduce(set)
+  static size_t get_reduce_memory(size_t size) {
+    return sizeof(Subset<N>) * get_reduce_chunk_size(size);
+  }
+
+  static void reduce(FastVector<Subset<N>>& set, FastVector<Subset<N>>& vec, SubsetsStats<N>* stats = nullptr) {
     Timer timer("reduce two");
     if (vec.empty()) return;
 
-    auto it = check_contains_subset(set, vec);
+    if constexpr (!SortUniqueDone) {
+      sort_unique(set, nullptr);
+      sort_unique(vec, stats);
+    }
+    auto it = check_contains_subset_dispatch(set.begin(), set.end(), vec.begin(), vec.end());
+    if (stats) stats->remove(it, vec.end());
     vec.resize(std::distance(vec.begin(), it));
   }
 
+  // reduces the range [begin, end) of a list in place (it is not sorted), returns the new end
+  static Iterator reduce(FastVector<Subset<N>>& set, Iterator begin, Iterator end) {
+    Timer timer("reduce range");
+    if (begin == end) return end;
+
+    if constexpr (!SortUniqueDone) {
+      sort_keep_unique(set, Compare{});
+    }
+    return check_contains_subset_dispatch(set.begin(), set.end(), begin, end);
+  }
+
 private:
 #if (GPU && (THREADS == 1))
   static constexpr uint M = 10000;
 #else
   static constexpr uint M = 6;
 #endif
+  // sliced leaves: more sets in a leaf, the leaves of at least SLICED_MIN_COUNT sets are
+  // tested by their columns
+  static constexpr uint SLICED_M = 64;
+  static constexpr uint SLICED_MIN_COUNT = 16;
 
 #if (GPU && (THREADS == 1))
   SubsetsImplicitTrieKernel<N, Proper> kernel;
@@ -76,75 +155,141 @@ private:
   FastVector<bool> kernel_ans;
 #endif
 
-  static Iterator check_contains_subset_singlethreaded(FastVector<Subset<N>>& set, FastVector<Subset<N>>& check) {
-    SubsetsImplicitTrie trie;
+  std::atomic<bool>* found = nullptr;  // shared by all threads of an any_contains_subset query
+  uint leaf_size = M;
+
+  static constexpr size_t PARALLEL_MIN_COUNT = 1 << 11;  // of the sets and the check sets of a forked node
+
+  static constexpr size_t REDUCE_CHUNKS = 16;
+  static constexpr size_t REDUCE_MIN_CHUNK_SIZE = 1 << 12;
+
+  static void sort_unique(FastVector<Subset<N>>& vec, SubsetsStats<N>* stats) {
+    std::sort(vec.begin(), vec.end(), Compare{});
+    if (stats) {
+      keep_unique(vec, [stats](const Subset<N>& sub) { stats->remove(sub); });
+    } else {
+      keep_unique(vec);
+    }
+  }
+
+  // With BITSLICED_LEAVES (and without the GPU), the leaves are sliced if the sets are
+  // dense enough (sparse enough for ComplementSet) for the columns to be faster.
+  SubsetsImplicitTrie(Iterator set_begin, Iterator set_end) {
+    if constexpr (BITSLICED_LEAVES && !(GPU && (THREADS == 1))) {
+      uint64 elements = 0;
+      for (auto it = set_begin; it != set_end; ++it) {
+        elements += it->size();
+      }
+      if (SubsetKernels<N>::template slicing_pays_off<SET_RELATION>(elements, std::distance(set_begin, set_end))) {
+        leaf_size = SLICED_M;
+      }
+    }
+  }
+
+  static size_t get_reduce_chunk_size(size_t size) {
+    return std::min(size, std::max(REDUCE_MIN_CHUNK_SIZE, (size + REDUCE_CHUNKS - 1) / REDUCE_CHUNKS));
+  }
+
+  static Iterator check_contains_subset_dispatch(Iterator set_begin, Iterator set_end, Iterator check_begin, Iterator check_end) {
+    if constexpr (Threads == 1 || (GPU && (THREADS == 1))) {
+      return check_contains_subset_singlethreaded(set_begin, set_end, check_begin, check_end);
+    } else {
+      if (std::max(std::distance(set_begin, set_end), std::distance(check_begin, check_end)) < 256) {
+        return check_contains_subset_singlethreaded(set_begin, set_end, check_begin, check_end);
+      } else {
+        return check_contains_subset_multithreaded(set_begin, set_end, check_begin, check_end);
+      }
+    }
+  }
+
+  static Iterator check_contains_subset_singlethreaded(Iterator set_begin, Iterator set_end, Iterator check_begin, Iterator check_end) {
+    SubsetsImplicitTrie trie(set_begin, set_end);
+#if (GPU && (THREADS == 1))
+      trie.kernel.allocate(std::addressof(*set_begin), std::distance(set_begin, set_end), std::distance(check_begin, check_end));
+      trie.first_set = set_begin;
+#endif
+    auto it = check_end;
+    trie.check_contains_subset_impl(0, set_begin, set_end, check_begin, it);
+    return it;
+  }
+
+  static bool any_contains_subset_singlethreaded(FastVector<Subset<N>>& set, FastVector<Subset<N>>& check) {
+    std::atomic<bool> found = false;
+    SubsetsImplicitTrie trie(set.begin(), set.end());
 #if (GPU && (THREADS == 1))
       trie.kernel.allocate(set.data(), set.size(), check.size());
       trie.first_set = set.begin();
 #endif
+    trie.found = &found;
     auto it = check.end();
-    trie.check_contains_subset_impl(0, set.begin(), set.end(), check.begin(), it);
+    trie.template check_contains_subset_impl<true>(0, set.begin(), set.end(), check.begin(), it);
+    return found.load();
+  }
+
+  static bool any_contains_subset_multithreaded(FastVector<Subset<N>>& set, FastVector<Subset<N>>& check) {
+    std::atomic<bool> found = false;
+    SubsetsImplicitTrie trie(set.begin(), set.end());
+    trie.found = &found;
+    auto it = check.end();
+    trie.template check_contains_subset_parallel<true>(0, set.begin(), set.end(), check.begin(), it);
+    return found.load();
+  }
+
+  static Iterator check_contains_subset_multithreaded(Iterator set_begin, Iterator set_end, Iterator check_begin, Iterator check_end) {
+    SubsetsImplicitTrie trie(set_begin, set_end);
+    auto it = check_end;
+    trie.check_contains_subset_parallel(0, set_begin, set_end, check_begin, it);
     return it;
   }
 
-  static Iterator check_contains_subset_multithreaded(FastVector<Subset<N>>& set, FastVector<Subset<N>>& check) {
-    using Range = std::pair<size_t, size_t>;
-    size_t set_cnt = std::distance(set.begin(), set.end());
-    size_t check_cnt = std::distance(check.begin(), check.end());
-
-    std::array<std::tuple<Range, size_t>, Threads> split;
-    std::array<std::pair<Iterator, Iterator>, Threads> ret;
-    for (size_t t = 0; t < Threads; ++t) {
-      split[t] = {
-        {t * check_cnt / Threads, (t + 1) * check_cnt / Threads}, t
-      };
-    }
+  // bit of a stored set as seen by the trie
+  template <bool Complement>
+  static bool is_set(const Subset<N>& sub, uint depth) {
+    return sub.is_set(depth) != Complement;
+  }
 
-    if constexpr (ThreadShuffle) {
-      std::random_shuffle(check.begin(), check.end());
-    }
+  // relation of a check to a set when the check contains the set as seen by the trie
+  static constexpr SetRelation CHECK_RELATION = (ComplementSet ? SetRelation::SUBSET_OF :
+      ComplementCheck ? SetRelation::DISJOINT_WITH : SetRelation::SUPERSET_OF);
 
-    static FastVector<std::thread> threads;
-    for (size_t t = 0; t < Threads; ++t) {
-      threads.push_back(std::thread([] (
-          uint t,
-          std::tuple<Range, size_t> ranges,
-          std::array<std::pair<Iterator, Iterator>, Threads>& ret,
-          FastVector<Subset<N>>& set,
-          FastVector<Subset<N>>& check) {
-
-        SubsetsImplicitTrie trie;
-        auto begin = check.begin() + std::get<0>(ranges).first;
-        auto end = check.begin() + std::get<0>(ranges).second;
-        auto it = end;
-        if constexpr (ThreadShuffle) {
-          std::sort(begin, end);
-        }
-        trie.check_contains_subset_impl(
-            0,
-            set.begin(),
-            set.end(),
-            begin,
-            it);
-
-        ret[t] = {begin, it};
-      }, t, split[t], std::ref(ret), std::ref(set), std::ref(check)));
-    }
+  // relation of a set to a check when the check contains it
+  static constexpr SetRelation SET_RELATION = (ComplementSet ? SetRelation::SUPERSET_OF :
+      ComplementCheck ? SetRelation::DISJOINT_WITH : SetRelation::SUBSET_OF);
 
-    for(auto& thread : threads) {
-      thread.join();
-    }
-    threads.clear();
+  // first check from check_begin containing set (or a proper one), check_end if none
+  static Iterator find_containing(const Subset<N>& set, Iterator check_begin, Iterator check_end) {
+    return check_begin + SubsetKernels<N>::template find_first<CHECK_RELATION, Proper>(
+        set, std::addressof(*check_begin), std::distance(check_begin, check_end));
+  }
 
-    auto it = check.begin();
-    for (size_t t = 0; t < Threads; ++t) {
-      if (ret[t].first != it) {
-        it = std::copy(ret[t].first, ret[t].second, it);
-      } else {
-        it = ret[t].second;
+  // The leaf of check_contains_subset_impl with the sets sliced into columns: each check
+  // finds all the sets it contains at once, one AND per element (per missing element).
+  template <bool Any>
+  void check_contains_subset_sliced(Iterator set_begin, uint set_count, Iterator check_begin, Iterator& check_end) {
+    uint64 columns[N];
+    SubsetKernels<N>::slice(std::addressof(*set_begin), set_count, columns);
+    uint64 all = (set_count == 64 ? ~0ULL : (1ULL << set_count) - 1);
+
+    auto it = check_begin;
+    while (it != check_end) {
+      auto candidates = SubsetKernels<N>::template filter_sliced<SET_RELATION>(*it, columns, all);
+      if constexpr (Proper) {
+        // at most one of the candidates (equal to the check) is not a proper one
+        for (; candidates; candidates &= candidates - 1) {
+          if (*std::next(set_begin, __builtin_ctzll(candidates)) != *it) break;
+        }
+      }
+      if (!candidates) {
+        ++it;
+        continue;
+      }
+      if constexpr (Any) {
+        found->store(true);
+        return;
       }
+      --check_end;
+      std::swap(*it, *check_end);
     }
-    return it;
   }
 
   // binary search first subset with <depth> bit set to one
@@ -152,7 +297,7 @@ private:
     while (count > 0) {
       auto step = count / 2;
       auto it = std::next(begin, step);
-      if (!it->is_set(depth)) {
+      if (!is_set<ComplementSet>(*it, depth)) {
         begin = ++it;
         count -= step + 1;
       } else {
@@ -162,58 +307,112 @@ private:
     return begin;
   }
 
+  // check_contains_subset_impl with the subtrees of the large nodes checked as parallel
+  // tasks. The check sets are partitioned by the bit first: the ones without it meet
+  // only the zero subtree, the ones with it meet both subtrees (one after the other).
+  // The sets found in both parts are then moved together to the back.
+  template <bool Any=false>
+  void check_contains_subset_parallel(uint depth, Iterator set_begin, Iterator set_end, Iterator check_begin, Iterator& check_end) {
+    size_t set_count = std::distance(set_begin, set_end);
+    size_t check_count = std::distance(check_begin, check_end);
+    if (set_count <= leaf_size || std::min(set_count, check_count) < PARALLEL_MIN_COUNT) {
+      check_contains_subset_impl<Any>(depth, set_begin, set_end, check_begin, check_end);
+      return;
+    }
+    if constexpr (Any) {
+      if (found->load(std::memory_order_relaxed)) return;
+    }
+
+    auto set_lo = binsearch_first_one(set_begin, depth, set_count);
+    auto mid = std::partition(check_begin, check_end, [depth] (const Subset<N>& sub) {
+      return !is_set<ComplementCheck>(sub, depth);
+    });
+
+    auto zero_end = mid;
+    auto one_end = check_end;
+    parallel_invoke(
+      [&] {
+        check_contains_subset_parallel<Any>(depth + 1, set_begin, set_lo, check_begin, zero_end);
+      },
+      [&] {
+        check_contains_subset_parallel<Any>(depth + 1, set_begin, set_lo, mid, one_end);
+        check_contains_subset_parallel<Any>(depth + 1, set_lo, set_end, mid, one_end);
+      });
+
+    check_end = std::rotate(zero_end, mid, one_end);
+  }
+
   // it's important that there are no duplicates between begin and end
+  // Any: stop after the first check set containing a subset is found (reported in *found)
+  template <bool Any=false>
   void check_contains_subset_impl(uint depth, Iterator set_begin, Iterator set_end, Iterator check_begin, Iterator& check_end) {
     if (set_begin == set_end || check_begin == check_end) return;
+    if constexpr (Any) {
+      if (found->load(std::memory_order_relaxed)) return;
+    }
 
     uint set_count = std::distance(set_begin, set_end);
     uint check_count = std::distance(check_begin, check_end);
 
-    if (set_count <= M) { // true for sure if depth == N
+    if (set_count <= leaf_size) { // true for sure if depth == N
 #if (GPU && (THREADS == 1))
-      // Timer timer("gpu");
-      // bool show = (std::rand()%50) == 0;
-      // bool show = true;
-      // if (show) std::cout << set_count << " " << check_count;
-      kernel_ans.resize(check_count);
-      kernel.run(
-        std::distance(first_set, set_begin),
-        set_count,
-        std::addressof(*check_begin),
-        check_count,
-        kernel_ans.data());
-      auto it = check_end;
-      for (int i = static_cast<int>(check_count) - 1; i >= 0; --i) {
-        --it;
-        if (kernel_ans[i]) {
-          --check_end;
-          std::swap(*it, *check_end);
+      if constexpr (!ComplementCheck) { // the kernel does not know about complements
+        // Timer timer("gpu");
+        // bool show = (std::rand()%50) == 0;
+        // bool show = true;
+        // if (show) std::cout << set_count << " " << check_count;
+        kernel_ans.resize(check_count);
+        auto old_check_end = check_end;
+        kernel.run(
+          std::distance(first_set, set_begin),
+          set_count,
+          std::addressof(*check_begin),
+          check_count,
+          kernel_ans.data());
+        auto it = check_end;
+        for (int i = static_cast<int>(check_count) - 1; i >= 0; --i) {
+          --it;
+          if (kernel_ans[i]) {
+            --check_end;
+            std::swap(*it, *check_end);
+          }
         }
+        if constexpr (Any) {
+          if (check_end != old_check_end) {
+            found->store(true);
+          }
+        }
+        // if (show) std::cout << " | " << cnt << std::endl;
+        // timer.template stop<false>();
+        return;
       }
-      // if (show) std::cout << " | " << cnt << std::endl;
-      // timer.template stop<false>();
-#else
+#endif
+#if BITSLICED_LEAVES
+      if (leaf_size == SLICED_M && set_count >= SLICED_MIN_COUNT) {
+        check_contains_subset_sliced<Any>(set_begin, set_count, check_begin, check_end);
+        return;
+      }
+#endif
+      if constexpr (Any) {
+        for (auto set = set_begin; set != set_end; ++set) {
+          if (find_containing(*set, check_begin, check_end) != check_end) {
+            found->store(true);
+            return;
+          }
+        }
+        return;
+      }
+
       for (auto set = set_begin; set != set_end; ++set) {
         auto it = check_begin;
         while (it != check_end) {
-          if constexpr (Proper) {
-            if (it->is_proper_subset(*set)) {
-              --check_end;
-              std::swap(*it, *check_end);
-            } else {
-              ++it;
-            }
-          } else {
-            if (it->is_subset(*set)) {
-              --check_end;
-              std::swap(*it, *check_end);
-            } else {
-              ++it;
-            }
+          it = find_containing(*set, it, check_end);
+          if (it != check_end) {
+            --check_end;
+            std::swap(*it, *check_end);
           }
         }
       }
-#endif
       return;
     }
 
@@ -224,7 +423,7 @@ private:
     auto set_lo = binsearch_first_one(set_begin, depth, set_count);
 
     if (set_begin != set_lo) {
-      check_contains_subset_impl(
+      check_contains_subset_impl<Any>(
         depth + 1,
         set_begin,
         set_lo,
@@ -239,10 +438,10 @@ private:
     auto lo = check_begin;
     auto hi = std::prev(check_end);
     while (true) {
-      while (lo < hi && hi->is_set(depth)) {
+      while (lo < hi && is_set<ComplementCheck>(*hi, depth)) {
         hi--;
       }
-      while (lo < hi && !lo->is_set(depth)) {
+      while (lo < hi && !is_set<ComplementCheck>(*lo, depth)) {
         lo++;
       }
       if (lo < hi) {
@@ -253,10 +452,10 @@ private:
         break;
       }
     }
-    if (!lo->is_set(depth)) lo++; // lo is the first element with bit set to one (or end)
+    if (!is_set<ComplementCheck>(*lo, depth)) lo++; // lo is the first element with bit set to one (or end)
 
     if (lo != check_end) {
-      check_contains_subset_impl(
+      check_contains_subset_impl<Any>(
         depth + 1,
         set_lo,
         set_end,
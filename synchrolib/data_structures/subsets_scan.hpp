@@ -0,0 +1,55 @@
+#pragma once
+#include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/data_structures/subset_kernels.hpp>
+#include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/vector.hpp>
+#include <synchrolib/utils/memory.hpp>
+#include <array>
+
+namespace synchrolib {
+
+// Copy of a list bucketed by the set sizes (counting sort). A set can be included
+// in (or disjoint with) a query only if it is small enough, so a query scans only
+// a prefix of the buckets. Meant for short lists, where building a trie does not pay off.
+template <uint N>
+class SubsetsScan : public MemoryUsage {
+public:
+  template <typename Iterator>
+  SubsetsScan(Iterator begin, Iterator end) {
+    bucket_begin.fill(0);
+    for (auto it = begin; it != end; ++it) {
+      bucket_begin[it->size() + 1]++;
+    }
+    for (uint n = 1; n <= N + 1; ++n) {
+      bucket_begin[n] += bucket_begin[n - 1];
+    }
+
+    auto pos = bucket_begin;
+    sets.resize(bucket_begin[N + 1]);
+    for (auto it = begin; it != end; ++it) {
+      sets[pos[it->size()]++] = *it;
+    }
+  }
+
+  size_t get_memory_usage() const override {
+    return synchrolib::get_memory_usage(sets);
+  }
+
+  // some set is a subset of sub
+  bool contains_subset_of(const Subset<N>& sub) const {
+    auto cnt = bucket_begin[sub.size() + 1];
+    return SubsetKernels<N>::template find_first<SetRelation::SUBSET_OF>(sub, sets.data(), cnt) != cnt;
+  }
+
+  // some set is disjoint with sub
+  bool contains_disjoint_with(const Subset<N>& sub) const {
+    auto cnt = bucket_begin[N - sub.size() + 1];
+    return SubsetKernels<N>::template find_first<SetRelation::DISJOINT_WITH>(sub, sets.data(), cnt) != cnt;
+  }
+
+private:
+  FastVector<Subset<N>> sets;
+  std::array<size_t, N + 2> bucket_begin;  // sets of size n are [bucket_begin[n], bucket_begin[n + 1])
+};
+
+}  // namespace synchrolib
@@ -0,0 +1,125 @@
+#pragma once
+#include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/utils/general.hpp>
+#include <array>
+
+namespace synchrolib {
+
+// Statistics of a list of sets, updated by the code that adds or removes the
+// sets (expansion, deduplication and reductions), so they are read without
+// scanning the list. Counters are unsigned, removing a set not added before
+// leaves them invalid.
+template <uint N>
+class SubsetsStats {
+public:
+  uint64 count = 0;
+  uint64 cardinality = 0;                   // sum of the sizes of the sets
+  std::array<uint64, N + 1> histogram{};    // number of sets of each size
+  std::array<uint64, N> frequency{};        // number of sets containing each state
+
+  SubsetsStats() = default;
+
+  template <typename Iterator>
+  SubsetsStats(Iterator begin, Iterator end) {
+    add(begin, end);
+  }
+
+  void add(const Subset<N>& sub) {
+    update<1>(sub);
+  }
+
+  void remove(const Subset<N>& sub) {
+    update<-1>(sub);
+  }
+
+  template <typename Iterator>
+  void add(Iterator begin, Iterator end) {
+    update<1>(begin, end);
+  }
+
+  template <typename Iterator>
+  void remove(Iterator begin, Iterator end) {
+    update<-1>(begin, end);
+  }
+
+  SubsetsStats& operator+=(const SubsetsStats& stats) {
+    count += stats.count;
+    cardinality += stats.cardinality;
+    for (uint n = 0; n <= N; ++n) histogram[n] += stats.histogram[n];
+    for (uint n = 0; n < N; ++n) frequency[n] += stats.frequency[n];
+    return *this;
+  }
+
+  // statistics of the complements of the sets
+  SubsetsStats negated() const {
+    SubsetsStats ret;
+    ret.count = count;
+    ret.cardinality = static_cast<uint64>(N) * count - cardinality;
+    for (uint n = 0; n <= N; ++n) ret.histogram[n] = histogram[N - n];
+    for (uint n = 0; n < N; ++n) ret.frequency[n] = count - frequency[n];
+    return ret;
+  }
+
+  // average fraction of states in a set
+  double density() const {
+    return static_cast<double>(cardinality) / (static_cast<double>(N) * count);
+  }
+
+  uint max_size() const {
+    uint n = N;
+    while (n > 0 && histogram[n] == 0) n--;
+    return n;
+  }
+
+private:
+  template <int Delta>
+  void update(const Subset<N>& sub) {
+    uint size = sub.size();
+    count += Delta;
+    cardinality += Delta * static_cast<int64>(size);
+    histogram[size] += Delta;
+    sub.count(frequency.data(), static_cast<uint64>(Delta));
+  }
+
+  // The frequencies are accumulated in byte counters, lane j of a bucket holds
+  // the counters of the bits j, j + 8, ..., j + 56, and they are flushed before
+  // they can overflow. This is branchless, unlike iterating over the set bits.
+  template <int Delta, typename Iterator>
+  void update(Iterator begin, Iterator end) {
+    constexpr uint B = Subset<N>::buckets();
+    constexpr uint64 LOW_BITS = 0x0101010101010101ULL;
+    constexpr uint BLOCK = 255;
+
+    std::array<uint64, B * 8> lanes{};
+    uint in_block = 0;
+    for (auto it = begin; it != end; ++it) {
+      uint size = it->size();
+      count += Delta;
+      cardinality += Delta * static_cast<int64>(size);
+      histogram[size] += Delta;
+      for (uint b = 0; b < B; ++b) {
+        for (uint j = 0; j < 8; ++j) lanes[b * 8 + j] += (it->v[b] >> j) & LOW_BITS;
+      }
+      if (++in_block == BLOCK) {
+        flush<Delta>(lanes);
+        in_block = 0;
+      }
+    }
+    flush<Delta>(lanes);
+  }
+
+  template <int Delta>
+  void flush(std::array<uint64, Subset<N>::buckets() * 8>& lanes) {
+    for (uint b = 0; b < Subset<N>::buckets(); ++b) {
+      for (uint j = 0; j < 8; ++j) {
+        for (uint i = 0; i < 8; ++i) {
+          uint n = b * SUBSETS_BITS + 8 * i + j;
+          if (n < N) frequency[n] += static_cast<uint64>(Delta) * ((lanes[b * 8 + j] >> (8 * i)) & 0xff);
+        }
+        lanes[b * 8 + j] = 0;
+      }
+    }
+  }
+};
+
+}  // namespace synchrolib
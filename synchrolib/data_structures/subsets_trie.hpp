@@ -1,72 +1,216 @@
 #pragma once
+#include <atomic>
+#include <cassert>
 #include <iostream>
 #include <vector>
 #include <limits>
 #include <mutex>
 #include <thread>
 #include <memory>
+#include <cstdio>
+#include <fstream>
+#include <string>
 
+#include <jitdefines.hpp>
 #include <synchrolib/data_structures/automaton.hpp>
 #include <synchrolib/data_structures/subset.hpp>
+#include <synchrolib/data_structures/subset_kernels.hpp>
 #include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/mapped_file.hpp>
 #include <synchrolib/utils/memory.hpp>
+#include <synchrolib/utils/thread_pool.hpp>
 #include <synchrolib/utils/timer.hpp>
 #include <synchrolib/utils/vector.hpp>
 
 namespace synchrolib {
 
 template <uint N, uint Threads>
-class SubsetsTrie : public MemoryUsage {
+class SubsetsTrie : public MemoryUsage, public NonCopyable {
 public:
 
+  // 12 bytes, five per cache line. The nodes are stored depth-first with the zero
+  // child first, so the zero child (if any) directly follows its parent and only the
+  // one child is linked: a subtree is a contiguous range and a path of zeros is read
+  // sequentially.
   struct Node {
-    uint zero, one; // it'ss possible to change zero from uint to bool - "is there a zero node?"
-    uint division_bit;
+    static constexpr uint8l HAS_ZERO = 0x80;
+    static constexpr uint MAX_POPCOUNT = 255;
 
-    uint subsets_cnt;
-    uint subsets_pos;
+    uint32l one;            // 0 if there's no one child
+    uint32l subsets_pos;
+    uint16l division_bit;
+    uint8l min_popcount;    // of the sets in the subtree, capped at MAX_POPCOUNT (a lower bound then)
+    uint8l info;            // HAS_ZERO and the number of the sets in the node
 
-    uint subtree_min_popcount;
-    
     Node():
-        zero(0),
         one(0),
-        division_bit(N),
-        subsets_cnt(0),
         subsets_pos(0),
-        subtree_min_popcount(std::numeric_limits<uint>::max()) {}
+        division_bit(N),
+        min_popcount(MAX_POPCOUNT),
+        info(0) {}
+
+    bool has_zero() const { return info & HAS_ZERO; }
+    uint subsets_cnt() const { return info & ~HAS_ZERO; }
+
+    void update_min_popcount(uint popcount) {
+      min_popcount = std::min<uint>(min_popcount, std::min(popcount, MAX_POPCOUNT));
+    }
   };
+  static_assert(N <= std::numeric_limits<uint16l>::max(), "division_bit is 16-bit");
 
   using Iterator = typename FastVector<Subset<N>>::iterator;
 
-  FastVector<Node> nodes;
-  FastVector<Subset<N>> subsets;
+  // of the built trie or of the mapped image
+  ArrayView<Node> nodes;
+  ArrayView<Subset<N>> subsets;
+  ArrayView<uint64> slices;  // of sliced leaves: the sets by blocks of 64 (N columns each)
 
   size_t get_memory_usage() const override {
-    return synchrolib::get_memory_usage(nodes)
-      + synchrolib::get_memory_usage(subsets);
+    return synchrolib::get_memory_usage(built_nodes)
+      + synchrolib::get_memory_usage(built_subsets)
+      + synchrolib::get_memory_usage(built_slices)
+      + (image ? image->size() : 0);
   }
 
   SubsetsTrie() { reset(); }
 
   void reset() {
-    nodes = FastVector<Node>(1);
-    subsets = FastVector<Subset<N>>();
+    image.reset();
+    built_nodes = FastVector<Node>(1);
+    built_subsets = FastVector<Subset<N>>();
+    built_slices = FastVector<uint64>();
+    attach(built_nodes, built_subsets, built_slices);
   }
 
   template <bool Swap=false>
   void build(FastVector<Subset<N>> vec) {
     Timer timer("build");
     reset();
-    subsets = std::move(vec);
-    sort_keep_unique(subsets);
-    subsets.shrink_to_fit();
+    built_subsets = std::move(vec);
+    sort_keep_unique(built_subsets);
+    built_subsets.shrink_to_fit();
+    bool sliced = sliced_leaves(built_subsets);
+    leaf_size = (sliced ? SLICED_M : M);
     if constexpr (Swap) {
-      build_impl_swap(0, 0, subsets.begin(), subsets.end());
+      if constexpr (Threads > 1) {
+        size_t min_parallel = std::max(PARALLEL_BUILD_MIN_COUNT, built_subsets.size() / (8 * Threads));
+        build_impl_parallel(built_nodes, 0, 0, built_subsets.begin(), built_subsets.end(), min_parallel);
+      } else {
+        build_impl_swap(built_nodes, 0, 0, built_subsets.begin(), built_subsets.end());
+      }
     } else {
-      build_impl(0, 0, subsets.begin(), subsets.end());
+      build_impl(0, 0, built_subsets.begin(), built_subsets.end());
+    }
+    built_nodes.shrink_to_fit();
+    if (sliced) {
+      build_slices();
+    }
+    attach(built_nodes, built_subsets, built_slices);
+  }
+
+  // the sets of a built trie (sorted, without duplicates), the trie is reset
+  FastVector<Subset<N>> release_subsets() {
+    FastVector<Subset<N>> vec = std::move(built_subsets);
+    reset();
+    return vec;
+  }
+
+  // Writes the trie as an image for load(): the header, then the nodes, the sets and the
+  // slices at offsets from the start of the file (aligned to IMAGE_ALIGNMENT). It's
+  // written to a temporary file renamed at the end, so a concurrent load never sees a
+  // partial image.
+  // Throws std::runtime_error when the file cannot be written.
+  void save(const std::string& path) const {
+    ImageHeader header{};
+    header.magic = IMAGE_MAGIC;
+    header.version = IMAGE_VERSION;
+    header.n = N;
+    header.node_size = sizeof(Node);
+    header.set_size = sizeof(Subset<N>);
+    header.nodes_offset = align(sizeof(ImageHeader));
+    header.nodes_count = nodes.size();
+    header.subsets_offset = align(header.nodes_offset + nodes.size() * sizeof(Node));
+    header.subsets_count = subsets.size();
+    header.slices_offset = align(header.subsets_offset + subsets.size() * sizeof(Subset<N>));
+    header.slices_count = slices.size();
+    header.checksum = data_checksum(nodes.begin(), nodes.size() * sizeof(Node))
+        ^ data_checksum(subsets.begin(), subsets.size() * sizeof(Subset<N>))
+        ^ data_checksum(slices.begin(), slices.size() * sizeof(uint64));
+
+    auto tmp_path = path + ".tmp" + std::to_string(getpid());
+    {
+      std::ofstream out(tmp_path, std::ios::binary);
+      auto write_at = [&out](uint64 offset, const void* data, size_t size) {
+        static const char zeros[IMAGE_ALIGNMENT] = {};
+        out.write(zeros, offset - out.tellp());
+        out.write(static_cast<const char*>(data), size);
+      };
+      write_at(0, &header, sizeof(header));
+      write_at(header.nodes_offset, nodes.begin(), nodes.size() * sizeof(Node));
+      write_at(header.subsets_offset, subsets.begin(), subsets.size() * sizeof(Subset<N>));
+      write_at(header.slices_offset, slices.begin(), slices.size() * sizeof(uint64));
+      if (!out.flush()) {
+        std::remove(tmp_path.c_str());
+        throw std::runtime_error("cannot write " + tmp_path);
+      }
+    }
+    if (std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+      std::remove(tmp_path.c_str());
+      throw std::runtime_error("cannot rename " + tmp_path + " to " + path);
     }
-    nodes.shrink_to_fit();
+  }
+
+  // Maps an image written by save() read-only and uses it in place, so the processes
+  // loading the same file share one copy. Returns false (and leaves the trie empty)
+  // if the file is missing or it isn't a valid image for N (sliced leaves are valid only
+  // with BITSLICED_LEAVES). Whether the leaves are sliced is kept from the build.
+  bool load(const std::string& path) {
+    reset();
+    std::unique_ptr<const MappedFile> file;
+    try {
+      file = std::make_unique<const MappedFile>(path);
+    } catch (const std::runtime_error&) {
+      return false;
+    }
+
+    ImageHeader header;
+    if (file->size() < sizeof(header)) {
+      return false;
+    }
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (header.magic != IMAGE_MAGIC || header.version != IMAGE_VERSION || header.n != N ||
+        header.node_size != sizeof(Node) || header.set_size != sizeof(Subset<N>) ||
+        header.nodes_count == 0 ||
+        (header.slices_count && header.slices_count != slices_count(header.subsets_count)) ||
+        header.nodes_offset % IMAGE_ALIGNMENT || header.subsets_offset % IMAGE_ALIGNMENT ||
+        header.slices_offset % IMAGE_ALIGNMENT ||
+        header.nodes_offset + header.nodes_count * sizeof(Node) > file->size() ||
+        header.subsets_offset + header.subsets_count * sizeof(Subset<N>) > file->size() ||
+        header.slices_offset + header.slices_count * sizeof(uint64) > file->size()) {
+      return false;
+    }
+
+    ArrayView<Node> image_nodes;
+    image_nodes.first = reinterpret_cast<const Node*>(file->data() + header.nodes_offset);
+    image_nodes.last = image_nodes.first + header.nodes_count;
+    ArrayView<Subset<N>> image_subsets;
+    image_subsets.first = reinterpret_cast<const Subset<N>*>(file->data() + header.subsets_offset);
+    image_subsets.last = image_subsets.first + header.subsets_count;
+    ArrayView<uint64> image_slices;
+    image_slices.first = reinterpret_cast<const uint64*>(file->data() + header.slices_offset);
+    image_slices.last = image_slices.first + header.slices_count;
+    if (header.checksum != (data_checksum(image_nodes.begin(), image_nodes.size() * sizeof(Node))
+        ^ data_checksum(image_subsets.begin(), image_subsets.size() * sizeof(Subset<N>))
+        ^ data_checksum(image_slices.begin(), image_slices.size() * sizeof(uint64)))) {
+      return false;
+    }
+
+    built_nodes = FastVector<Node>();
+    image = std::move(file);
+    nodes = image_nodes;
+    subsets = image_subsets;
+    slices = image_slices;
+    return true;
   }
 
   // template <bool Proper=false>
@@ -74,8 +218,9 @@ public:
   //   return contains_subset_of_impl<Proper>(root(), set);
   // }
 
+  // stop: optional flag shared between concurrent queries, the search is abandoned (returns false) once it's set
   template <bool Proper=false>
-  bool contains_subset_of(Iterator begin, Iterator end) const {
+  bool contains_subset_of(Iterator begin, Iterator end, const std::atomic<bool>* stop = nullptr) const {
     // for (auto it = begin; it != end; ++it) {
     //   if (contains_subset_of(*it)) {
     //     return true;
@@ -86,7 +231,7 @@ public:
       return false;
     }
     uint set_size = begin->size();
-    return contains_subset_of_impl<Proper>(root(), begin, end, set_size);
+    return contains_subset_of_impl<Proper>(0, begin, end, set_size, stop);
   }
 
   void get_sets_list(FastVector<Subset<N>> &vec) const {
@@ -148,18 +293,92 @@ public:
 
 private:
   static constexpr uint M = 10;
+  // sliced leaves: more sets in a leaf, the nodes of at least SLICED_MIN_COUNT sets are
+  // tested by their columns
+  static constexpr uint SLICED_M = 64;
+  static_assert(SLICED_M < Node::HAS_ZERO, "the number of the sets of a node is 7-bit");
+  static constexpr uint SLICED_MIN_COUNT = 16;
+  static constexpr size_t PARALLEL_BUILD_MIN_COUNT = 1 << 14;  // sets of a node whose subtrees are built in parallel
+
+  static constexpr uint64 IMAGE_MAGIC = 0x45495254434E5953ULL;  // "SYNCTRIE"
+  static constexpr uint IMAGE_VERSION = 3;
+  static constexpr size_t IMAGE_ALIGNMENT = 64;
+
+  // all offsets are from the start of the file, so the image can be mapped anywhere
+  struct ImageHeader {
+    uint64 magic;
+    uint version;
+    uint n;
+    uint node_size;
+    uint set_size;
+    uint64 nodes_offset;
+    uint64 nodes_count;
+    uint64 subsets_offset;
+    uint64 subsets_count;
+    uint64 slices_offset;
+    uint64 slices_count;
+    uint64 checksum;  // of the nodes, the sets and the slices
+  };
 
-  Node& root() {
-    return nodes[0];
+  FastVector<Node> built_nodes;
+  FastVector<Subset<N>> built_subsets;
+  FastVector<uint64> built_slices;
+  std::unique_ptr<const MappedFile> image;
+  uint leaf_size = M;
+
+  void attach(const FastVector<Node>& node_vec, const FastVector<Subset<N>>& subset_vec,
+      const FastVector<uint64>& slice_vec) {
+    nodes.first = node_vec.data();
+    nodes.last = node_vec.data() + node_vec.size();
+    subsets.first = subset_vec.data();
+    subsets.last = subset_vec.data() + subset_vec.size();
+    slices.first = slice_vec.data();
+    slices.last = slice_vec.data() + slice_vec.size();
   }
 
-  const Node& root() const {
-    return nodes[0];
+  static uint64 slices_count(uint64 subsets_count) {
+    return BITSLICED_LEAVES ? (subsets_count + 63) / 64 * N : 0;
   }
 
-  uint create_node() {
-    nodes.emplace_back();
-    return nodes.size() - 1;
+  // With BITSLICED_LEAVES, the leaves are sliced if the sets are dense enough for the
+  // columns to be faster (a query ANDs the columns of the elements it lacks).
+  static bool sliced_leaves(const FastVector<Subset<N>>& vec) {
+    if constexpr (!BITSLICED_LEAVES) {
+      return false;
+    }
+    uint64 elements = 0;
+    for (const auto& sub : vec) {
+      elements += sub.size();
+    }
+    return SubsetKernels<N>::template slicing_pays_off<SetRelation::SUBSET_OF>(elements, vec.size());
+  }
+
+  // the columns of the sets of each block of 64 (of the final order, the nodes keep
+  // ranges of the sets, so the sets of a node are in at most two blocks)
+  void build_slices() {
+    size_t blocks = (built_subsets.size() + 63) / 64;
+    built_slices.resize(blocks * N);
+    parallel_for(0, blocks, 64, [this] (size_t lo, size_t hi) {
+      for (size_t block = lo; block < hi; ++block) {
+        size_t first = block * 64;
+        size_t cnt = std::min<size_t>(64, built_subsets.size() - first);
+        SubsetKernels<N>::slice(&built_subsets[first], cnt, &built_slices[block * N]);
+      }
+    }, Threads);
+  }
+
+  static uint64 align(uint64 offset) {
+    return (offset + IMAGE_ALIGNMENT - 1) / IMAGE_ALIGNMENT * IMAGE_ALIGNMENT;
+  }
+
+  static uint create_node(FastVector<Node>& arena) {
+    arena.emplace_back();
+    return arena.size() - 1;
+  }
+
+  static void add_set(FastVector<Node>& arena, uint v, const Subset<N>& sub) {
+    arena[v].info++;
+    arena[v].update_min_popcount(sub.size());
   }
 
   // it's important that there are no duplicates between begin and end
@@ -167,11 +386,10 @@ private:
     if (begin == end) return;
 
     uint count = std::distance(begin, end);
-    if (count <= M) { // true for sure if depth == N
-      nodes[v].subsets_pos = std::distance(subsets.begin(), begin);
+    if (count <= leaf_size) { // true for sure if depth == N
+      built_nodes[v].subsets_pos = std::distance(built_subsets.begin(), begin);
       while (begin != end) {
-        nodes[v].subsets_cnt++;
-        nodes[v].subtree_min_popcount = std::min(nodes[v].subtree_min_popcount, begin->size());
+        add_set(built_nodes, v, *begin);
         ++begin;
       }
       return;
@@ -180,7 +398,7 @@ private:
     while (begin->is_set(depth) == std::prev(end)->is_set(depth)) {
       depth++;
     }
-    nodes[v].division_bit = depth;
+    built_nodes[v].division_bit = depth;
 
     // binary search first subset with <depth> bit set to one
     auto lo = begin;
@@ -195,11 +413,10 @@ private:
       }
     }
 
-    if (std::distance(begin, lo) <= M) {
-      nodes[v].subsets_pos = std::distance(subsets.begin(), begin);
-      while (begin != end && nodes[v].subsets_cnt < M) {
-        nodes[v].subsets_cnt++;
-        nodes[v].subtree_min_popcount = std::min(nodes[v].subtree_min_popcount, begin->size());
+    if (std::distance(begin, lo) <= leaf_size) {
+      built_nodes[v].subsets_pos = std::distance(built_subsets.begin(), begin);
+      while (begin != end && built_nodes[v].subsets_cnt() < leaf_size) {
+        add_set(built_nodes, v, *begin);
         ++begin;
       }
       if (lo < begin) {
@@ -207,11 +424,11 @@ private:
       }
     }
     // TODO: maybe it's a good idea to place ones if we can remove the one link (probably not)
-    // nodes[v].subsets_pos = std::distance(subsets.begin(), begin);
-    // while (begin != end && nodes[v].subsets_cnt < M) {
-    //   nodes[v].subsets_cnt++;
-    //   nodes[v].subtree_min_popcount = std::min(nodes[v].subtree_min_popcount, begin->size());
-    //   nodes[v].subtree_and &= *begin;
+    // built_nodes[v].subsets_pos = std::distance(built_subsets.begin(), begin);
+    // while (begin != end && built_nodes[v].subsets_cnt < M) {
+    //   built_nodes[v].subsets_cnt++;
+    //   built_nodes[v].subtree_min_popcount = std::min(built_nodes[v].subtree_min_popcount, begin->size());
+    //   built_nodes[v].subtree_and &= *begin;
     //   ++begin;
     // }
     // if (lo < begin) {
@@ -220,35 +437,37 @@ private:
 
     if (begin != lo) {
       // path of zeros is close in memory
-      nodes[v].zero = create_node();
-      build_impl(nodes[v].zero, depth + 1, begin, lo);
-      nodes[v].subtree_min_popcount = std::min(nodes[v].subtree_min_popcount, nodes[nodes[v].zero].subtree_min_popcount);
+      uint zero = create_node(built_nodes);
+      assert(zero == v + 1);
+      built_nodes[v].info |= Node::HAS_ZERO;
+      build_impl(zero, depth + 1, begin, lo);
+      built_nodes[v].update_min_popcount(built_nodes[zero].min_popcount);
     }
 
     if (lo != end) {
-      nodes[v].one = create_node();
-      build_impl(nodes[v].one, depth + 1, lo, end);
-      nodes[v].subtree_min_popcount = std::min(nodes[v].subtree_min_popcount, nodes[nodes[v].one].subtree_min_popcount);
+      uint one = create_node(built_nodes);
+      built_nodes[v].one = one;
+      build_impl(one, depth + 1, lo, end);
+      built_nodes[v].update_min_popcount(built_nodes[one].min_popcount);
     }
   }
 
-  // it's important that there are no duplicates between begin and end
-  void build_impl_swap(uint v, int depth, Iterator begin, Iterator end) {
-    if (begin == end) return;
-
+  // Sets up node v of arena for [begin, end) (reordered) as in the sequential build
+  // and returns the ranges of its children: [first, lo) for the zero subtree and
+  // [lo, end) for the one subtree (a leaf keeps all the sets, first = lo = end).
+  std::pair<Iterator, Iterator> split_node(FastVector<Node>& arena, uint v, Iterator begin, Iterator end) {
     size_t all = std::distance(begin, end);
-    if (all <= M) { // true for sure if depth == N
-      nodes[v].subsets_pos = std::distance(subsets.begin(), begin);
+    if (all <= leaf_size) { // true for sure if depth == N
+      arena[v].subsets_pos = std::distance(built_subsets.begin(), begin);
       while (begin != end) {
-        nodes[v].subsets_cnt++;
-        nodes[v].subtree_min_popcount = std::min(nodes[v].subtree_min_popcount, begin->size());
+        add_set(arena, v, *begin);
         ++begin;
       }
-      return;
+      return {end, end};
     }
 
     uint division_bit = get_division_bit(begin, end);
-    nodes[v].division_bit = division_bit;
+    arena[v].division_bit = division_bit;
 
     auto lo = begin;
     auto hi = std::prev(end);
@@ -270,77 +489,115 @@ private:
     if (!lo->is_set(division_bit)) lo++; // lo is the first element with bit set to one (or end)
 
     // subsets_cnt > 0 only if there is no zero child
-    if (std::distance(begin, lo) <= M) {
-      nodes[v].subsets_pos = std::distance(subsets.begin(), begin);
-      while (begin != end && nodes[v].subsets_cnt < M) {
-        nodes[v].subsets_cnt++;
-        nodes[v].subtree_min_popcount = std::min(nodes[v].subtree_min_popcount, begin->size());
+    if (std::distance(begin, lo) <= leaf_size) {
+      arena[v].subsets_pos = std::distance(built_subsets.begin(), begin);
+      while (begin != end && arena[v].subsets_cnt() < leaf_size) {
+        add_set(arena, v, *begin);
         ++begin;
       }
       if (lo < begin) {
         lo = begin;
       }
     }
+    return {begin, lo};
+  }
 
-    if (begin != lo) {
+  // it's important that there are no duplicates between begin and end
+  void build_impl_swap(FastVector<Node>& arena, uint v, int depth, Iterator begin, Iterator end) {
+    if (begin == end) return;
+
+    auto [first, lo] = split_node(arena, v, begin, end);
+
+    if (first != lo) {
       // path of zeros is close in memory
-      nodes[v].zero = create_node();
-      build_impl_swap(nodes[v].zero, depth + 1, begin, lo);
-      nodes[v].subtree_min_popcount = std::min(nodes[v].subtree_min_popcount, nodes[nodes[v].zero].subtree_min_popcount);
+      uint zero = create_node(arena);
+      assert(zero == v + 1);
+      arena[v].info |= Node::HAS_ZERO;
+      build_impl_swap(arena, zero, depth + 1, first, lo);
+      arena[v].update_min_popcount(arena[zero].min_popcount);
     }
 
     if (lo != end) {
-      nodes[v].one = create_node();
-      build_impl_swap(nodes[v].one, depth + 1, lo, end);
-      nodes[v].subtree_min_popcount = std::min(nodes[v].subtree_min_popcount, nodes[nodes[v].one].subtree_min_popcount);
+      uint one = create_node(arena);
+      arena[v].one = one;
+      build_impl_swap(arena, one, depth + 1, lo, end);
+      arena[v].update_min_popcount(arena[one].min_popcount);
     }
   }
 
+  // build_impl_swap with the subtrees of the nodes of at least min_parallel sets built
+  // as parallel tasks, each into its own arena. The arenas are appended after the
+  // node in the same depth-first order (the links shifted), so the trie is the same
+  // as the sequential one. v is the last node of arena.
+  void build_impl_parallel(FastVector<Node>& arena, uint v, int depth, Iterator begin, Iterator end, size_t min_parallel) {
+    if (static_cast<size_t>(std::distance(begin, end)) < min_parallel) {
+      build_impl_swap(arena, v, depth, begin, end);
+      return;
+    }
+
+    auto [first, lo] = split_node(arena, v, begin, end);
+
+    FastVector<Node> zero_arena(first != lo ? 1 : 0);
+    FastVector<Node> one_arena(lo != end ? 1 : 0);
+    parallel_invoke(
+      [&, first = first, lo = lo] {
+        if (first != lo) {
+          build_impl_parallel(zero_arena, 0, depth + 1, first, lo, min_parallel);
+        }
+      },
+      [&, lo = lo] {
+        if (lo != end) {
+          build_impl_parallel(one_arena, 0, depth + 1, lo, end, min_parallel);
+        }
+      });
+
+    if (!zero_arena.empty()) {
+      uint zero = append_arena(arena, zero_arena);
+      assert(zero == v + 1);
+      arena[v].info |= Node::HAS_ZERO;
+      arena[v].update_min_popcount(arena[zero].min_popcount);
+    }
+    if (!one_arena.empty()) {
+      uint one = append_arena(arena, one_arena);
+      arena[v].one = one;
+      arena[v].update_min_popcount(arena[one].min_popcount);
+    }
+  }
+
+  // appends the nodes of a subtree built in its own arena, returns the index of its root
+  static uint append_arena(FastVector<Node>& arena, const FastVector<Node>& sub_arena) {
+    uint offset = arena.size();
+    arena.reserve(offset + sub_arena.size());
+    for (Node node : sub_arena) {
+      if (node.one) {
+        node.one += offset;
+      }
+      arena.push_back(node);
+    }
+    return offset;
+  }
+
   inline uint get_division_bit(Iterator begin, Iterator end) {
     size_t all = std::distance(begin, end);
     int count[N] = {};
 
-    size_t thread_cnt = std::min(static_cast<size_t>(Threads), all / 350 + 1);
-    if (thread_cnt == 1) {
+    if (Threads == 1 || all < 2 * 350) {
       for (auto it = begin; it != end; ++it) {
         it->count(count);
       }
     } else {
-      using Range = std::pair<size_t, size_t>;
-
-      std::array<std::tuple<Range, size_t>, Threads> split;
-      for (size_t t = 0; t < thread_cnt; ++t) {
-        split[t] = {
-          {t * all / thread_cnt, (t + 1) * all / thread_cnt}, t
-        };
-      }
-
       std::mutex write_mutex;
-      static FastVector<std::thread> threads;
-      for (size_t t = 0; t < thread_cnt; ++t) {
-        threads.push_back(std::thread([] (
-            std::tuple<Range, size_t> range,
-            std::mutex& write_mutex,
-            int count[],
-            Iterator& begin) {
-
-          int cnt[N] = {};
-          auto end = begin + std::get<0>(range).second;
-          for (auto it = begin + std::get<0>(range).first; it != end; ++it) {
-            it->count(cnt);
-          }
-
-          const std::lock_guard<std::mutex> lock(write_mutex);
-          for (uint i = 0; i < N; ++i) {
-            count[i] += cnt[i];
-          }
-        }, split[t], std::ref(write_mutex), count, std::ref(begin)));
-      }
+      parallel_for(0, all, 350, [&write_mutex, &count, begin] (size_t lo, size_t hi) {
+        int cnt[N] = {};
+        for (auto it = begin + lo; it != begin + hi; ++it) {
+          it->count(cnt);
+        }
 
-      for(auto& thread : threads) {
-        thread.join();
-      }
-      threads.clear();
+        const std::lock_guard<std::mutex> lock(write_mutex);
+        for (uint i = 0; i < N; ++i) {
+          count[i] += cnt[i];
+        }
+      }, Threads);
     }
 
     for (uint i = 0; i < N; ++i) {
@@ -349,23 +606,69 @@ private:
     return std::distance(count, std::max_element(count, count + N));
   }
 
+  // some set stored in the node is a subset (a proper one) of set
+  template <bool Proper>
+  bool contains_subset_in_node(const Subset<N>& set, const Node& node) const {
+    auto cnt = node.subsets_cnt();
+    if constexpr (BITSLICED_LEAVES) {
+      if (cnt >= SLICED_MIN_COUNT && !slices.empty()) {
+        return contains_subset_sliced<Proper>(set, node.subsets_pos, cnt);
+      }
+    }
+    return SubsetKernels<N>::template find_first<SetRelation::SUBSET_OF, Proper>(
+        set, &subsets[node.subsets_pos], cnt) != cnt;
+  }
+
+  // contains_subset_in_node by the columns of the blocks of the sets [pos, pos + cnt)
+  template <bool Proper>
+  bool contains_subset_sliced(const Subset<N>& set, size_t pos, size_t cnt) const {
+    for (size_t block = pos / 64; block * 64 < pos + cnt; ++block) {
+      size_t lo = std::max(pos, block * 64) - block * 64;
+      size_t hi = std::min(pos + cnt, block * 64 + 64) - block * 64;
+      uint64 candidates = (hi == 64 ? ~0ULL : (1ULL << hi) - 1) & ~((1ULL << lo) - 1);
+      candidates = SubsetKernels<N>::template filter_sliced<SetRelation::SUBSET_OF>(
+          set, &slices[block * N], candidates);
+      for (; candidates; candidates &= candidates - 1) {
+        // at most one of the candidates (equal to set) is not a proper subset
+        if (!Proper || set != subsets[block * 64 + __builtin_ctzll(candidates)]) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
   // TODO: removing maskelim seems to speed up the algorithm
   template <bool Proper>
-  bool contains_subset_of_impl(const Node& node, Iterator begin, Iterator end, uint set_size) const {
-    assert(!node.zero || node.one);
+  bool contains_subset_of_impl(uint v, Iterator begin, Iterator end, uint set_size, const std::atomic<bool>* stop) const {
+    const Node& node = nodes[v];
+    assert(!node.has_zero() || node.one);
+
+    if (stop && stop->load(std::memory_order_relaxed)) {
+      return false;
+    }
 
     if constexpr (Proper) {
-      if (set_size <= node.subtree_min_popcount) {
+      if (set_size <= node.min_popcount) {
         return false;
       }
     } else {
-      if (set_size < node.subtree_min_popcount) {
+      if (set_size < node.min_popcount) {
         return false;
       }
     }
 
+    // the zero child is next to the node, the one child and the sets are fetched
+    // while the zero subtree (or the sets) are checked
+    if (node.one) {
+      __builtin_prefetch(&nodes[node.one]);
+    }
+    if (node.subsets_cnt()) {
+      __builtin_prefetch(&subsets[node.subsets_pos]);
+    }
+
     auto it = begin;
-    if (node.zero) {
+    if (node.has_zero()) {
       // while (it != end) {
       //   if constexpr (Proper) {
       //     if (!it->is_proper_subset(node.subtree_and)) {
@@ -386,7 +689,7 @@ private:
       // if (begin == end) {
       //   return false;
       // }
-      if (contains_subset_of_impl<Proper>(nodes[node.zero], begin, end, set_size)) {
+      if (contains_subset_of_impl<Proper>(v + 1, begin, end, set_size, stop)) {
         return true;
       }
     } else if (node.one) {
@@ -396,10 +699,8 @@ private:
           //   --end;
           //   std::swap(*it, *end);
           // } else {
-            for (const Subset<N> *s = &subsets[node.subsets_pos]; s != &subsets[node.subsets_pos+node.subsets_cnt]; ++s) {
-              if (it->is_proper_subset(*s)) {
-                return true;
-              }
+            if (contains_subset_in_node<true>(*it, node)) {
+              return true;
             }
             ++it;
           // }
@@ -408,10 +709,8 @@ private:
           //   --end;
           //   std::swap(*it, *end);
           // } else {
-            for (const Subset<N> *s = &subsets[node.subsets_pos]; s != &subsets[node.subsets_pos+node.subsets_cnt]; ++s) {
-              if (it->is_subset(*s)) {
-                return true;
-              }
+            if (contains_subset_in_node<false>(*it, node)) {
+              return true;
             }
             ++it;
           // }
@@ -424,18 +723,14 @@ private:
       while (it != end) {
         if constexpr (Proper) {
           // if (it->is_proper_subset(node.subtree_and)) {
-            for (const Subset<N> *s = &subsets[node.subsets_pos]; s != &subsets[node.subsets_pos+node.subsets_cnt]; ++s) {
-              if (it->is_proper_subset(*s)) {
-                return true;
-              }
+            if (contains_subset_in_node<true>(*it, node)) {
+              return true;
             }
           // }
         } else {
           // if (it->is_subset(node.subtree_and)) {
-            for (const Subset<N> *s = &subsets[node.subsets_pos]; s != &subsets[node.subsets_pos+node.subsets_cnt]; ++s) {
-              if (it->is_subset(*s)) {
-                return true;
-              }
+            if (contains_subset_in_node<false>(*it, node)) {
+              return true;
             }
           // }
         }
@@ -464,7 +759,7 @@ private:
     lb_endwhile:;
     if (!lo->is_set(bit)) lo++; // lo is the first element with bit set to one (or end)
     
-    return (lo != end) && contains_subset_of_impl<Proper>(nodes[node.one], lo, end, set_size);
+    return (lo != end) && contains_subset_of_impl<Proper>(node.one, lo, end, set_size, stop);
   }
 
   // TODO: make popcount static
@@ -500,7 +795,7 @@ private:
   //     return contains_subset_of_impl<Proper>(nodes[node.one], set);
   //   }
 
-  //   for (const Subset<N> *s = &subsets[node.subsets_pos]; s != &subsets[node.subsets_pos+node.subsets_cnt]; s++) {
+  //   for (const Subset<N> *s = &subsets[node.subsets_pos]; s != &subsets[node.subsets_pos+node.subsets_cnt()]; s++) {
   //     if constexpr (Proper) {
   //       if (set.is_proper_subset(*s)) {
   //         return true;
@@ -0,0 +1,68 @@
+#pragma once
+#include <synchrolib/utils/general.hpp>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <exception>
+#include <limits>
+
+namespace synchrolib {
+
+class InterruptedException : public std::exception {
+  const char* what() const throw() { return "InterruptedException"; }
+};
+
+// Stop request for a long computation: SIGINT or SIGTERM received while a scope
+// exists, or the deadline of the scope passed. The computation checks requested()
+// between its steps and stops cleanly, keeping the bounds it has proven. A second
+// signal is handled by the default handler (terminates). The signal sets the flag
+// given to set_flag, which the program owns, as the library is unloaded after each
+// automaton (the program then skips the remaining automata).
+class InterruptScope : public NonCopyable, public NonMovable {
+public:
+  // max_time_s = 0 means no deadline
+  InterruptScope(uint64 max_time_s) {
+    deadline_ = (max_time_s ?
+        (Clock::now() + std::chrono::seconds(max_time_s)).time_since_epoch().count() :
+        std::numeric_limits<int64>::max());
+
+    struct sigaction action {};
+    action.sa_handler = handle;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESETHAND;
+    sigaction(SIGINT, &action, &previous_int);
+    sigaction(SIGTERM, &action, &previous_term);
+  }
+
+  ~InterruptScope() {
+    sigaction(SIGINT, &previous_int, nullptr);
+    sigaction(SIGTERM, &previous_term, nullptr);
+    deadline_ = std::numeric_limits<int64>::max();
+  }
+
+  static void set_flag(std::atomic<bool>& flag) { signaled_ = &flag; }
+
+  static bool requested() {
+    return *signaled_ || Clock::now().time_since_epoch().count() > deadline_;
+  }
+
+  static bool signaled() { return *signaled_; }
+
+  static void check() {
+    if (requested()) {
+      throw InterruptedException();
+    }
+  }
+
+private:
+  struct sigaction previous_int;
+  struct sigaction previous_term;
+
+  inline static std::atomic<bool> own_flag_{false};  // without set_flag
+  inline static std::atomic<bool>* signaled_ = &own_flag_;
+  inline static std::atomic<int64> deadline_{std::numeric_limits<int64>::max()};
+
+  static void handle(int) { *signaled_ = true; }
+};
+
+}  // namespace synchrolib
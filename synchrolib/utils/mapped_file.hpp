@@ -0,0 +1,65 @@
+#pragma once
+#include <synchrolib/utils/general.hpp>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace synchrolib {
+
+// Whole file mapped read-only. The processes mapping the same file share its pages
+// (with the page cache), so it costs no private memory. A missing or unreadable file
+// throws std::runtime_error.
+class MappedFile : public NonCopyable, public NonMovable {
+public:
+  MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+      throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+      close(fd);
+      throw std::runtime_error("cannot map " + path);
+    }
+    size_ = st.st_size;
+    void* ptr = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ptr == MAP_FAILED) {
+      throw std::runtime_error("cannot map " + path + ": " + std::strerror(errno));
+    }
+    data_ = static_cast<const char*>(ptr);
+  }
+
+  ~MappedFile() {
+    munmap(const_cast<char*>(data_), size_);
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  const char* data_;
+  size_t size_;
+};
+
+// 64-bit checksum of size bytes (read as words, the tail bytewise)
+inline uint64 data_checksum(const void* data, size_t size) {
+  auto ptr = static_cast<const char*>(data);
+  uint64 h = size;
+  for (; size >= 8; ptr += 8, size -= 8) {
+    uint64 word;
+    std::memcpy(&word, ptr, 8);
+    h = ((h ^ word) * 0x9E3779B97F4A7C15ULL) ^ (h >> 31);
+  }
+  for (; size; ++ptr, --size) {
+    h = ((h ^ static_cast<unsigned char>(*ptr)) * 0x9E3779B97F4A7C15ULL) ^ (h >> 31);
+  }
+  return h;
+}
+
+}  // namespace synchrolib
@@ -0,0 +1,46 @@
+#pragma once
+#include <synchrolib/utils/general.hpp>
+#include <sys/mman.h>
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+
+namespace synchrolib {
+
+// Array in an anonymous shared mapping, so it stays shared with the processes
+// forked after its creation (other memory is only copied on write). T should be
+// trivially copyable or lock-free atomic, to be used from several processes.
+template <typename T>
+class SharedArray : public NonCopyable, public NonMovable {
+public:
+  SharedArray(size_t size): size_(size) {
+    void* ptr = mmap(nullptr, bytes(), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED) {
+      throw std::runtime_error("mmap of a shared array failed");
+    }
+    data_ = static_cast<T*>(ptr);
+    for (size_t i = 0; i < size_; ++i) {
+      new (data_ + i) T();
+    }
+  }
+
+  ~SharedArray() {
+    for (size_t i = 0; i < size_; ++i) {
+      data_[i].~T();
+    }
+    munmap(data_, bytes());
+  }
+
+  size_t size() const { return size_; }
+  T& operator[](size_t i) { return data_[i]; }
+  const T& operator[](size_t i) const { return data_[i]; }
+
+private:
+  T* data_;
+  size_t size_;
+
+  size_t bytes() const { return std::max<size_t>(1, size_ * sizeof(T)); }
+};
+
+}  // namespace synchrolib
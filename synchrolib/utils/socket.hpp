@@ -0,0 +1,227 @@
+#pragma once
+#include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/vector.hpp>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <unistd.h>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+namespace synchrolib {
+
+class SocketException : public std::runtime_error {
+public:
+  using std::runtime_error::runtime_error;
+};
+
+// Blocking TCP socket sending plain values. The values are sent as raw bytes, so
+// both ends have to be the same build on the same architecture (as the workers
+// compile the same library). A closed connection or an error throws SocketException.
+class Socket : public NonCopyable {
+public:
+  Socket(): fd_(-1) {}
+  explicit Socket(int fd): fd_(fd) {}
+  Socket(Socket&& other) noexcept: fd_(std::exchange(other.fd_, -1)) {}
+  Socket& operator=(Socket&& other) noexcept {
+    close();
+    fd_ = std::exchange(other.fd_, -1);
+    return *this;
+  }
+  ~Socket() { close(); }
+
+  static Socket listen(uint port) {
+    Socket socket(::socket(AF_INET, SOCK_STREAM, 0));
+    if (socket.fd_ < 0) {
+      throw SocketException(error("socket"));
+    }
+    int one = 1;
+    setsockopt(socket.fd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(socket.fd_, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+      throw SocketException(error("bind"));
+    }
+    if (::listen(socket.fd_, SOMAXCONN) < 0) {
+      throw SocketException(error("listen"));
+    }
+    return socket;
+  }
+
+  static Socket connect(const std::string& host, uint port) {
+    addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* info;
+    if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &info) != 0) {
+      throw SocketException("cannot resolve " + host);
+    }
+
+    Socket socket(::socket(AF_INET, SOCK_STREAM, 0));
+    int ret = (socket.fd_ < 0 ? -1 : ::connect(socket.fd_, info->ai_addr, info->ai_addrlen));
+    freeaddrinfo(info);
+    if (ret < 0) {
+      throw SocketException(error("connect"));
+    }
+    socket.set_nodelay();
+    return socket;
+  }
+
+  Socket accept() const {
+    Socket socket(::accept(fd_, nullptr, nullptr));
+    if (socket.fd_ < 0) {
+      throw SocketException(error("accept"));
+    }
+    socket.set_nodelay();
+    return socket;
+  }
+
+  int get_fd() const { return fd_; }
+  bool is_open() const { return fd_ >= 0; }
+
+  // the descriptor is no longer closed by this object
+  int release() { return std::exchange(fd_, -1); }
+
+  void close() {
+    if (fd_ >= 0) {
+      ::close(fd_);
+      fd_ = -1;
+    }
+  }
+
+  // a send or a receive making no progress for this long throws SocketException
+  void set_timeout(std::chrono::milliseconds timeout) {
+    timeval tv{};
+    tv.tv_sec = timeout.count() / 1000;
+    tv.tv_usec = (timeout.count() % 1000) * 1000;
+    setsockopt(fd_, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd_, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  }
+
+  // the calls blocked on the socket in other threads return (and throw)
+  void shutdown() {
+    if (fd_ >= 0) {
+      ::shutdown(fd_, SHUT_RDWR);
+    }
+  }
+
+  // some data (or the end of the connection) can be received without blocking
+  bool readable(int timeout_ms = 0) const {
+    pollfd pfd{fd_, POLLIN, 0};
+    return poll(&pfd, 1, timeout_ms) > 0;
+  }
+
+  void send_bytes(const void* data, size_t size) {
+    auto ptr = static_cast<const char*>(data);
+    while (size) {
+      auto sent = ::send(fd_, ptr, size, MSG_NOSIGNAL);
+      if (sent < 0 && errno == EINTR) continue;
+      if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        throw SocketException("send timed out");
+      }
+      if (sent <= 0) {
+        throw SocketException(error("send"));
+      }
+      ptr += sent;
+      size -= sent;
+    }
+  }
+
+  void recv_bytes(void* data, size_t size) {
+    auto ptr = static_cast<char*>(data);
+    while (size) {
+      auto received = ::recv(fd_, ptr, size, 0);
+      if (received < 0 && errno == EINTR) continue;
+      if (received == 0) {
+        throw SocketException("connection closed");
+      }
+      if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        throw SocketException("recv timed out");
+      }
+      if (received < 0) {
+        throw SocketException(error("recv"));
+      }
+      ptr += received;
+      size -= received;
+    }
+  }
+
+  template <typename T>
+  void send(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    send_bytes(&value, sizeof(T));
+  }
+
+  template <typename T>
+  T recv() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    recv_bytes(&value, sizeof(T));
+    return value;
+  }
+
+  template <typename Iterator>
+  void send_range(Iterator begin, Iterator end) {
+    uint64 size = std::distance(begin, end);
+    send(size);
+    if (size) {
+      send_bytes(std::addressof(*begin), size * sizeof(*begin));
+    }
+  }
+
+  // a longer vector than max_size (a broken peer) throws before anything is allocated
+  template <typename T>
+  FastVector<T> recv_vector(uint64 max_size) {
+    FastVector<T> vec(recv_size(max_size));
+    recv_bytes(vec.data(), vec.size() * sizeof(T));
+    return vec;
+  }
+
+  void send_string(const std::string& str) {
+    send<uint64>(str.size());
+    send_bytes(str.data(), str.size());
+  }
+
+  std::string recv_string(uint64 max_size) {
+    std::string str(recv_size(max_size), '\0');
+    recv_bytes(str.data(), str.size());
+    return str;
+  }
+
+private:
+  int fd_;
+
+  uint64 recv_size(uint64 max_size) {
+    auto size = recv<uint64>();
+    if (size > max_size) {
+      throw SocketException("received size " + std::to_string(size) + " above " + std::to_string(max_size));
+    }
+    return size;
+  }
+
+  void set_nodelay() {
+    int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  }
+
+  static std::string error(const std::string& call) {
+    return call + ": " + std::strerror(errno);
+  }
+};
+
+}  // namespace synchrolib
@@ -1,86 +1,247 @@
 #pragma once
+#include <jitdefines.hpp>
 #include <synchrolib/utils/general.hpp>
-#include <utility>
-#include <thread>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
-#include <queue>
+#include <deque>
+#include <exception>
+#include <functional>
 #include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
 
 namespace synchrolib {
 
+class TaskGroup;
+
+// Persistent pool of workers running the jobs of task groups. A thread waiting for
+// its group runs the queued jobs of that group meanwhile, so jobs may start and
+// wait for groups of their own, and the waiting thread counts as one more worker.
+// It never starts a job of another group, which could keep it from returning long
+// after its own group is done (and nest the waits without a bound), so it waits on
+// the condition variable of its group, not on the one of the workers.
+// The workers are recreated in a forked child (they don't exist there).
 class ThreadPool : public NonCopyable, public NonMovable {
 public:
   using Job = std::function<void()>;
 
-  ThreadPool(): running(false) {}
   ~ThreadPool() {
-    if (running) {
-      wait();
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      terminate = true;
+    }
+    cv.notify_all();
+    for (auto& thread : threads) {
+      thread.join();
     }
   }
 
-  void start(size_t num_threads) {
-    running = true;
-    terminate = false;
-    for (size_t i = 0; i < num_threads; ++i) {
+  // number of threads running jobs at once, with the waiting one
+  size_t get_concurrency() const { return workers + 1; }
+
+  // the pool of the library, with THREADS threads
+  static ThreadPool& global() {
+    static ThreadPool pool(THREADS - 1);
+    return pool;
+  }
+
+private:
+  friend class TaskGroup;
+
+  struct Entry {
+    Job job;
+    TaskGroup* group;
+  };
+
+  size_t workers;
+  std::vector<std::thread> threads;
+  bool terminate;
+
+  std::mutex mutex;
+  std::condition_variable cv;  // of the workers, a waiting thread uses the one of its group
+  std::deque<Entry> queue;
+
+  ThreadPool(size_t workers): workers(workers), terminate(false) {
+    start();
+    pthread_atfork(before_fork, after_fork_parent, after_fork_child);
+  }
+
+  void start() {
+    for (size_t i = 0; i < workers; ++i) {
       threads.push_back(std::thread([this] { this->loop(); }));
     }
   }
 
-  void add_job(Job job) {
-    {
-      std::unique_lock<std::mutex> lock(queue_mutex);
-      queue.push(job);
-    }
+  inline void push(Entry entry);
+  inline void execute(Entry& entry);
 
-    queue_cv.notify_one();
+  void loop() {
+    while (true) {
+      Entry entry;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [this] { return !queue.empty() || terminate; });
+        if (queue.empty()) {
+          break;
+        }
+        entry = std::move(queue.front());
+        queue.pop_front();
+      }
+      execute(entry);
+    }
   }
 
-  void wait() {
-    {
-      std::unique_lock<std::mutex> lock(queue_mutex);
-      terminate = true;
+  // no worker holds the mutex while forking, so the queue is consistent in the child
+  static void before_fork() { global().mutex.lock(); }
+  static void after_fork_parent() { global().mutex.unlock(); }
+
+  // The mutex (locked above), the condition variable (the workers may have been
+  // waiting on it) and the handles of the threads are of the parent, destroying them
+  // is undefined (a joinable std::thread terminates). Fresh ones are constructed in
+  // their storage instead.
+  static void after_fork_child() {
+    auto& pool = global();
+    new (&pool.mutex) std::mutex();
+    new (&pool.cv) std::condition_variable();
+    for (auto& thread : pool.threads) {
+      new (&thread) std::thread();
     }
+    pool.threads.clear();
+    pool.start();
+  }
+};
 
-    queue_cv.notify_all();
+// created when the library is loaded (and joined when it's unloaded)
+inline ThreadPool& global_thread_pool = ThreadPool::global();
 
-    for (auto& thread : threads) {
-      thread.join();
+// Jobs run by the pool, wait() returns when all of them are done and rethrows the
+// first exception thrown by a job.
+class TaskGroup : public NonCopyable, public NonMovable {
+public:
+  TaskGroup(ThreadPool& pool = ThreadPool::global()): pool(pool), pending(0) {}
+
+  ~TaskGroup() {
+    if (pending) {
+      help();
     }
-    threads.clear();
+  }
+
+  void run(ThreadPool::Job job) {
+    pending++;
+    pool.push({std::move(job), this});
+  }
 
-    running = false;
+  void wait() {
+    help();
+    if (exception) {
+      std::rethrow_exception(std::exchange(exception, nullptr));
+    }
   }
 
 private:
-  std::vector<std::thread> threads;
-  bool terminate;
-  bool running;
+  friend class ThreadPool;
 
-  std::mutex queue_mutex;
-  std::condition_variable queue_cv;
-  std::queue<Job> queue;
+  ThreadPool& pool;
+  std::atomic<size_t> pending;
+  std::exception_ptr exception;  // guarded by the mutex of the pool
+  std::condition_variable cv;    // a job queued or all done, with the mutex of the pool
 
-  void loop() {
+  void help() {
     while (true) {
-      Job job;
+      ThreadPool::Entry entry;
       {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        queue_cv.wait(lock, [this](){
-          return !queue.empty() || terminate;
+        std::unique_lock<std::mutex> lock(pool.mutex);
+        auto own = pool.queue.rend();
+        cv.wait(lock, [this, &own] {
+          own = std::find_if(pool.queue.rbegin(), pool.queue.rend(),
+              [this](const ThreadPool::Entry& e) { return e.group == this; });
+          return pending == 0 || own != pool.queue.rend();
         });
-
-        if (queue.empty()) {
-          break;
+        if (pending == 0) {
+          return;
         }
-
-        job = queue.front();
-        queue.pop();
+        entry = std::move(*own);
+        pool.queue.erase(std::next(own).base());
       }
-
-      job();
+      pool.execute(entry);
     }
   }
 };
 
-}  // namespace synchrolib
\ No newline at end of file
+// The group is notified under the mutex: its waiting thread may destroy it as soon
+// as it sees the change.
+inline void ThreadPool::push(Entry entry) {
+  std::unique_lock<std::mutex> lock(mutex);
+  auto group = entry.group;
+  queue.push_back(std::move(entry));
+  cv.notify_one();
+  group->cv.notify_one();
+}
+
+inline void ThreadPool::execute(Entry& entry) {
+  auto group = entry.group;
+  std::exception_ptr exception;
+  try {
+    entry.job();
+  } catch (...) {
+    exception = std::current_exception();
+  }
+  entry.job = nullptr;
+
+  std::unique_lock<std::mutex> lock(mutex);
+  if (exception && !group->exception) {
+    group->exception = exception;
+  }
+  if (--group->pending == 0) {
+    group->cv.notify_all();
+  }
+}
+
+// runs a and b in parallel
+template <class A, class B>
+void parallel_invoke(A&& a, B&& b) {
+  TaskGroup group;
+  group.run(std::forward<A>(a));
+  b();
+  group.wait();
+}
+
+// calls fun(lo, hi) for at most parts ranges covering [begin, end), each of at
+// least grain elements (or one range for less)
+template <class Fun>
+void parallel_for(size_t begin, size_t end, size_t grain, Fun fun,
+    size_t parts = ThreadPool::global().get_concurrency()) {
+  size_t cnt = end - begin;
+  parts = std::max<size_t>(1, std::min(parts, cnt / std::max<size_t>(1, grain)));
+  if (parts == 1) {
+    fun(begin, end);
+    return;
+  }
+
+  TaskGroup group;
+  for (size_t t = 1; t < parts; ++t) {
+    size_t lo = begin + cnt * t / parts;
+    size_t hi = begin + cnt * (t + 1) / parts;
+    group.run([&fun, lo, hi] { fun(lo, hi); });
+  }
+  fun(begin, begin + cnt / parts);
+  group.wait();
+}
+
+template<class T, class Comp=std::less<T>>
+void parallel_sort(T* data, int len, int grainsize, Comp comp=Comp{}) {
+  if (len < grainsize) {
+    std::sort(data, data + len, comp);
+  } else {
+    parallel_invoke(
+        [=] { parallel_sort<T, Comp>(data, len/2, grainsize, comp); },
+        [=] { parallel_sort<T, Comp>(data + len/2, len - len/2, grainsize, comp); });
+    std::inplace_merge(data, data + len/2, data + len, comp);
+  }
+}
+
+}  // namespace synchrolib
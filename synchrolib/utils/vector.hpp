@@ -1,7 +1,7 @@
 #pragma once
 // #include <external/uwr/vector.hpp>
 #include <external/uwr/vector.hpp>
-#include <future>
+#include <algorithm>
 // #include <vector>
 
 namespace synchrolib {
@@ -9,27 +9,67 @@ namespace synchrolib {
 template<typename T>
 using FastVector = uwr::vector<T>;
 
+// read-only array owned elsewhere (e.g. by a FastVector or a mapped file)
+template<typename T>
+struct ArrayView {
+  const T* first = nullptr;
+  const T* last = nullptr;
+
+  const T* begin() const { return first; }
+  const T* end() const { return last; }
+  size_t size() const { return last - first; }
+  bool empty() const { return first == last; }
+  const T& operator[](size_t i) const { return first[i]; }
+};
+
 template<typename T>
 void keep_unique(FastVector<T>& vec) {
   vec.resize(std::distance(vec.begin(), std::unique(vec.begin(), vec.end())));
 }
 
+// removed(x) is called for each removed duplicate
+template<typename T, class Removed>
+void keep_unique(FastVector<T>& vec, Removed removed) {
+  if (vec.empty()) return;
+  auto out = vec.begin();
+  for (auto it = std::next(vec.begin()); it != vec.end(); ++it) {
+    if (*it == *out) {
+      removed(*it);
+    } else {
+      *++out = *it;
+    }
+  }
+  vec.resize(std::distance(vec.begin(), out) + 1);
+}
+
 template<typename T, class Comp=std::less<T>>
 void sort_keep_unique(FastVector<T>& vec, Comp comp=Comp{}) {
   std::sort(vec.begin(), vec.end(), comp);
   keep_unique(vec);
 }
 
-template<class T, class Comp=std::less<T>>
-void parallel_sort(T* data, int len, int grainsize, Comp comp=Comp{}) {
-  if (len < grainsize) {
-    std::sort(data, data + len, comp);
-  } else {
-    auto future = std::async(parallel_sort<T, Comp>, data, len/2, grainsize, comp);
-    parallel_sort<T, Comp>(data + len/2, len - len/2, grainsize, comp);
-    future.wait();
-    std::inplace_merge(data, data + len/2, data + len, comp);
+// merges the sorted and unique [first, last) into the sorted and unique vec, keeping
+// it unique, removed(x) is called for each element of [first, last) already in vec;
+// in place from the back, the capacity of vec should hold both
+template<typename T, class Removed, class Comp=std::less<T>>
+void merge_keep_unique(FastVector<T>& vec, const T* first, const T* last, Removed removed, Comp comp=Comp{}) {
+  const size_t size = vec.size();
+  vec.resize(size + std::distance(first, last));
+  T* const begin = vec.data();
+  T* const end = vec.data() + vec.size();
+  T* in = begin + size;
+  T* out = end;
+  while (first != last) {
+    if (in != begin && comp(*std::prev(last), *std::prev(in))) {
+      *--out = *--in;
+    } else {
+      if (in != begin && !comp(*std::prev(in), *std::prev(last))) {
+        removed(*--in);
+      }
+      *--out = *--last;
+    }
   }
+  vec.resize(std::distance(begin, std::move(out, end, in)));
 }
 
 }  // namespace synchrolib
@@ -0,0 +1,138 @@
+#pragma once
+#include <synchrolib/utils/general.hpp>
+#include <synchrolib/utils/thread_pool.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace synchrolib {
+
+// Each worker has its own deque of tasks: it takes the newest task of its deque
+// (so it goes depth first) and, when the deque is empty, steals the oldest task
+// of another worker (usually the biggest part of the search). Tasks may push new
+// tasks to the deque of the worker running them. run() returns when all tasks are
+// done, the first exception thrown by a task stops the workers and is rethrown.
+// The workers are jobs of the global thread pool, the first one runs on the calling
+// thread. A worker that starts late (the pool is busy) finds its tasks stolen.
+template <typename Task>
+class WorkStealingPool : public NonCopyable, public NonMovable {
+public:
+  using Function = std::function<void(Task&, uint worker)>;
+
+  WorkStealingPool(uint workers): pending(0), queued(0), failed(false) {
+    for (uint i = 0; i < workers; ++i) {
+      deques.push_back(std::make_unique<Deque>());
+    }
+  }
+
+  uint get_workers() const { return deques.size(); }
+
+  void push(uint worker, Task task) {
+    pending++;
+    {
+      std::unique_lock<std::mutex> lock(deques[worker]->mutex);
+      deques[worker]->tasks.push_back(std::move(task));
+    }
+    {
+      std::unique_lock<std::mutex> lock(idle_mutex);
+      queued++;
+    }
+    idle_cv.notify_one();
+  }
+
+  void run(Function fun) {
+    TaskGroup group;
+    for (uint worker = 1; worker < deques.size(); ++worker) {
+      group.run([this, worker, &fun] { this->loop(worker, fun); });
+    }
+    loop(0, fun);
+    group.wait();
+
+    for (auto& deque : deques) {
+      deque->tasks.clear();
+    }
+    pending = queued = 0;
+    if (failed) {
+      failed = false;
+      std::rethrow_exception(exception);
+    }
+  }
+
+private:
+  struct Deque {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::vector<std::unique_ptr<Deque>> deques;
+  std::atomic<size_t> pending;  // pushed and not finished
+  size_t queued;                // pushed and not taken, guarded by idle_mutex
+  bool failed;                  // guarded by idle_mutex
+  std::exception_ptr exception;
+
+  std::mutex idle_mutex;
+  std::condition_variable idle_cv;
+
+  bool take(uint worker, Task& task) {
+    for (uint i = 0; i < deques.size(); ++i) {
+      auto& deque = *deques[(worker + i) % deques.size()];
+      std::unique_lock<std::mutex> lock(deque.mutex);
+      if (deque.tasks.empty()) {
+        continue;
+      }
+      if (i == 0) {
+        task = std::move(deque.tasks.back());
+        deque.tasks.pop_back();
+      } else {
+        task = std::move(deque.tasks.front());
+        deque.tasks.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  void loop(uint worker, Function& fun) {
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        idle_cv.wait(lock, [this] { return queued > 0 || pending == 0 || failed; });
+        if (failed || (queued == 0 && pending == 0)) {
+          break;
+        }
+        queued--;
+      }
+
+      // a task is reserved, so some deque holds it until it's taken
+      Task task;
+      while (!take(worker, task)) {
+        std::this_thread::yield();
+      }
+
+      try {
+        fun(task, worker);
+      } catch (...) {
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        if (!failed) {
+          failed = true;
+          exception = std::current_exception();
+        }
+        idle_cv.notify_all();
+      }
+
+      if (--pending == 0) {
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        idle_cv.notify_all();
+      }
+    }
+  }
+};
+
+}  // namespace synchrolib